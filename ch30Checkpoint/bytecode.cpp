@@ -0,0 +1,733 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bytecode.hpp"
+#include "memory.hpp"
+#include "optimizer.hpp"
+#include "vm.hpp"
+
+// a .loxc file holds the function tree of one compiled script, laid out so it can be mapped and read in
+// place. every field is a host-order integer on a four-byte boundary (a file from a machine of the other
+// byte order fails the version check):
+//
+//   header     magic, version, hash of the source, hash of everything after the header, string, global
+//              and function counts, file size
+//   strings    length then bytes, padded, for every name and string constant the functions use
+//   globals    the string index of each global slot the code was compiled against
+//   functions  one record per function, nested functions ahead of the one that creates them, so the
+//              script comes last
+//
+// a function record is arity, upvalue count, stack depth, name and the counts below, then the code, the
+// runs of the line table, the constant table and the names behind the chunk's inline caches
+#define BYTECODE_MAGIC "LOXC"
+#define NO_NAME        UINT32_MAX
+
+typedef struct {
+    char     magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+    uint64_t imageHash;
+    uint32_t stringCount;
+    uint32_t globalCount;
+    uint32_t functionCount;
+    uint32_t reserved;
+    uint64_t size;
+} BytecodeHeader;
+
+// enumerates what a constant table entry holds
+typedef enum {
+    CONSTANT_NUMBER,
+    CONSTANT_STRING,
+    CONSTANT_FUNCTION
+} ConstantTag;
+
+// a constant table entry: the string or function index, or a number's bits
+typedef struct {
+    uint32_t tag;
+    uint32_t index;
+    uint64_t bits;
+} BytecodeConstant;
+
+#define HASH_SEED 14695981039346656037ULL
+
+// folds length bytes into hash (64-bit FNV-1a), so a hash can run across several buffers
+static uint64_t hashBytes (uint64_t hash, const void* bytes, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= ((const uint8_t*)bytes)[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// hashes the source text a .loxc file was compiled from
+uint64_t hashSource (const char* source, size_t length) { return hashBytes(HASH_SEED, source, length); }
+
+// growable output buffer; it never holds objects, so it stays out of the GC's accounting
+typedef struct {
+    uint8_t* data;
+    size_t   count;
+    size_t   capacity;
+} Writer;
+
+// appends length bytes to the writer
+static void writeBytes (Writer* writer, const void* bytes, size_t length) {
+    if (writer->count + length > writer->capacity) {
+        size_t capacity = writer->capacity < 256 ? 256 : writer->capacity;
+        while (capacity < writer->count + length) capacity *= 2;
+
+        writer->data = (uint8_t*)realloc(writer->data, capacity);
+        if (writer->data == NULL) exit(1);
+        writer->capacity = capacity;
+    }
+
+    memcpy(writer->data + writer->count, bytes, length);
+    writer->count += length;
+}
+
+static void writeU32 (Writer* writer, uint32_t value) { writeBytes(writer, &value, sizeof(value)); }
+
+// pads the writer out to the next four-byte boundary
+static void writePadding (Writer* writer) {
+    static const uint8_t zeroes[4] = { 0, 0, 0, 0 };
+    writeBytes(writer, zeroes, (4 - writer->count % 4) % 4);
+}
+
+// state for writing one script: the string and function sections fill up side by side, and each string
+// is written once however many places use it
+typedef struct {
+    Writer strings;
+    Writer functions;
+    Table  stringIndex; // string -> its index in the string section
+    int    stringCount;
+    int    functionCount;
+} Saver;
+
+// returns the index of string in the string section, adding it the first time it comes up
+static uint32_t saveString (Saver* saver, ObjString* string) {
+    Value index;
+    if (tableGet(&saver->stringIndex, string, &index)) return (uint32_t)AS_NUMBER(index);
+
+    tableSet(&saver->stringIndex, string, NUMBER_VAL((double)saver->stringCount));
+    writeU32(&saver->strings, string->length);
+    writeBytes(&saver->strings, string->chars, string->length);
+    writePadding(&saver->strings);
+    return saver->stringCount++;
+}
+
+// writes the record of function after those of the functions in its constant table, returning its index
+static uint32_t saveFunction (Saver* saver, ObjFunction* function) {
+    Chunk*    chunk   = &function->chunk;
+    uint32_t* indexes = (uint32_t*)malloc(sizeof(uint32_t) * (chunk->constants.count + 1));
+    if (indexes == NULL) exit(1);
+
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value value = chunk->constants.values[i];
+        if (IS_FUNCTION(value))    indexes[i] = saveFunction(saver, AS_FUNCTION(value));
+        else if (IS_STRING(value)) indexes[i] = saveString(saver, AS_STRING(value));
+        else                       indexes[i] = 0;
+    }
+
+    Writer* out = &saver->functions;
+    writeU32(out, function->arity);
+    writeU32(out, function->upvalueCount);
+    writeU32(out, function->maxSlots);
+    writeU32(out, function->name == NULL ? NO_NAME : saveString(saver, function->name));
+    // runs past the end are left over from the compiler cutting code short
+    int lineCount = 0;
+    while (lineCount < chunk->lineCount && chunk->lines[lineCount].offset < chunk->count) lineCount++;
+
+    writeU32(out, chunk->count);
+    writeU32(out, lineCount);
+    writeU32(out, chunk->constants.count);
+    writeU32(out, chunk->cacheCount);
+    writeU32(out, chunk->invokeCacheCount);
+
+    writeBytes(out, chunk->code, chunk->count);
+    writePadding(out);
+    for (int i = 0; i < lineCount; i++) {
+        writeU32(out, (uint32_t)chunk->lines[i].offset);
+        writeU32(out, (uint32_t)chunk->lines[i].line);
+    }
+
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value            value    = chunk->constants.values[i];
+        BytecodeConstant constant = { CONSTANT_NUMBER, indexes[i], 0 };
+        if (IS_FUNCTION(value))    constant.tag = CONSTANT_FUNCTION;
+        else if (IS_STRING(value)) constant.tag = CONSTANT_STRING;
+        else {
+            double number = AS_NUMBER(value);
+            memcpy(&constant.bits, &number, sizeof(number));
+        }
+        writeBytes(out, &constant, sizeof(constant));
+    }
+
+    for (int i = 0; i < chunk->cacheCount; i++) writeU32(out, saveString(saver, chunk->caches[i].name));
+    for (int i = 0; i < chunk->invokeCacheCount; i++) writeU32(out, saveString(saver, chunk->invokeCaches[i].name));
+
+    free(indexes);
+    return saver->functionCount++;
+}
+
+// writes all of length bytes to file
+static bool writeAll (FILE* file, const void* data, size_t length) {
+    return length == 0 || fwrite(data, 1, length, file) == length;
+}
+
+// writes the compiled script to path as a .loxc file keyed by sourceHash. the file is written under a
+// temporary name and renamed into place, so a concurrent run never maps half of it
+bool saveBytecode (ObjFunction* script, uint64_t sourceHash, const char* path) {
+    Saver saver;
+    memset(&saver, 0, sizeof(saver));
+    initTable(&saver.stringIndex);
+    push(OBJ_VAL(script)); // the string index allocates, and the script isn't running yet
+
+    saveFunction(&saver, script);
+
+    Writer globals;
+    memset(&globals, 0, sizeof(globals));
+    for (int i = 0; i < vm.globalNames.count; i++) {
+        writeU32(&globals, saveString(&saver, AS_STRING(vm.globalNames.values[i])));
+    }
+
+    BytecodeHeader header;
+    memcpy(header.magic, BYTECODE_MAGIC, sizeof(header.magic));
+    header.version       = BYTECODE_VERSION;
+    header.sourceHash    = sourceHash;
+    header.imageHash     = hashBytes(hashBytes(hashBytes(HASH_SEED, saver.strings.data, saver.strings.count),
+                                               globals.data, globals.count),
+                                     saver.functions.data, saver.functions.count);
+    header.stringCount   = saver.stringCount;
+    header.globalCount   = vm.globalNames.count;
+    header.functionCount = saver.functionCount;
+    header.reserved      = 0;
+    header.size          = sizeof(header) + saver.strings.count + globals.count + saver.functions.count;
+
+    size_t length    = strlen(path) + 32;
+    char*  temporary = (char*)malloc(length);
+    if (temporary == NULL) exit(1);
+    snprintf(temporary, length, "%s.%ld.tmp", path, (long)getpid());
+
+    bool  saved = false;
+    FILE* file  = fopen(temporary, "wb");
+    if (file != NULL) {
+        saved = writeAll(file, &header, sizeof(header)) &&
+                writeAll(file, saver.strings.data, saver.strings.count) &&
+                writeAll(file, globals.data, globals.count) &&
+                writeAll(file, saver.functions.data, saver.functions.count);
+        saved = fclose(file) == 0 && saved;
+        saved = saved && rename(temporary, path) == 0;
+        if (!saved) remove(temporary);
+    }
+
+    free(temporary);
+    free(globals.data);
+    free(saver.strings.data);
+    free(saver.functions.data);
+    freeTable(&saver.stringIndex);
+    pop();
+    return saved;
+}
+
+// bounds-checked cursor over a mapped file; once a read runs past the end, every later read fails too
+typedef struct {
+    const uint8_t* start;
+    const uint8_t* current;
+    const uint8_t* end;
+    bool           ok;
+} Reader;
+
+// returns the next length bytes in place, or NULL past the end of the file
+static const uint8_t* readBytes (Reader* reader, size_t length) {
+    if (!reader->ok || (size_t)(reader->end - reader->current) < length) {
+        reader->ok = false;
+        return NULL;
+    }
+
+    const uint8_t* bytes = reader->current;
+    reader->current += length;
+    return bytes;
+}
+
+static uint32_t readU32 (Reader* reader) {
+    const uint8_t* bytes = readBytes(reader, sizeof(uint32_t));
+    uint32_t       value = 0;
+    if (bytes != NULL) memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static void skipPadding (Reader* reader) { readBytes(reader, (4 - (reader->current - reader->start) % 4) % 4); }
+
+// reads the u32 at index in an array left in place in the file
+static uint32_t arrayU32 (const uint8_t* array, uint32_t index) {
+    uint32_t value;
+    memcpy(&value, array + index * sizeof(uint32_t), sizeof(value));
+    return value;
+}
+
+// a string in the string section
+typedef struct {
+    const char* chars;
+    uint32_t    length;
+} StringRecord;
+
+// a function record with its arrays left in the file
+typedef struct {
+    uint32_t       arity;
+    uint32_t       upvalueCount;
+    uint32_t       maxSlots;
+    uint32_t       name;
+    uint32_t       codeCount;
+    uint32_t       lineCount;
+    uint32_t       constantCount;
+    uint32_t       cacheCount;
+    uint32_t       invokeCacheCount;
+    const uint8_t* code;
+    const uint8_t* lines;            // u32 offset and line per run
+    const uint8_t* constants;        // BytecodeConstant per entry
+    const uint8_t* cacheNames;       // u32 string index per cache
+    const uint8_t* invokeCacheNames; // u32 string index per invoke cache
+} FunctionRecord;
+
+// reads the next function record; false when it runs past the end of the file
+static bool readFunctionRecord (Reader* reader, FunctionRecord* record) {
+    record->arity            = readU32(reader);
+    record->upvalueCount     = readU32(reader);
+    record->maxSlots         = readU32(reader);
+    record->name             = readU32(reader);
+    record->codeCount        = readU32(reader);
+    record->lineCount        = readU32(reader);
+    record->constantCount    = readU32(reader);
+    record->cacheCount       = readU32(reader);
+    record->invokeCacheCount = readU32(reader);
+
+    record->code = readBytes(reader, record->codeCount);
+    skipPadding(reader);
+    record->lines            = readBytes(reader, (size_t)record->lineCount * 2 * sizeof(uint32_t));
+    record->constants        = readBytes(reader, (size_t)record->constantCount * sizeof(BytecodeConstant));
+    record->cacheNames       = readBytes(reader, (size_t)record->cacheCount * sizeof(uint32_t));
+    record->invokeCacheNames = readBytes(reader, (size_t)record->invokeCacheCount * sizeof(uint32_t));
+    return reader->ok;
+}
+
+// reads constant table entry index of a function record
+static BytecodeConstant recordConstant (const FunctionRecord* record, uint32_t index) {
+    BytecodeConstant constant;
+    memcpy(&constant, record->constants + index * sizeof(BytecodeConstant), sizeof(constant));
+    return constant;
+}
+
+// describes the operands of an instruction, one letter each: k/K any constant by 8/24-bit index, s/S a
+// string constant, f/F a function constant (followed by its capture pairs), l/L a frame slot by 8/16-bit
+// index, u/U an upvalue, g a global slot, c a property cache, i an invoke cache, b a plain byte, j a
+// forward jump and J a backward one. NULL for a byte that isn't an opcode
+static const char* operandKinds (uint8_t instruction) {
+    switch (instruction) {
+        case OP_CONSTANT:                return "k";
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_POP:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_PRINT:
+        case OP_CLOSE_UPVALUE:
+        case OP_RETURN:
+        case OP_INHERIT:
+        case OP_ADD_NUMBER:
+        case OP_SUBTRACT_NUMBER:
+        case OP_LESS_NUMBER:
+        case OP_GREATER_NUMBER:          return "";
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_SET_LOCAL_POP:           return "l";
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:              return "g";
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:             return "u";
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_GET_THIS_PROPERTY:       return "c";
+        case OP_GET_SUPER:
+        case OP_CLASS:
+        case OP_METHOD:                  return "s";
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_TRUE:
+        case OP_JUMP_IF_FALSE_OR_POP:
+        case OP_JUMP_IF_TRUE_OR_POP:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_LESS:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_GREATER:
+        case OP_JUMP_IF_NOT_EQUAL:
+        case OP_JUMP_IF_EQUAL:           return "j";
+        case OP_LOOP:                    return "J";
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_POPN:                    return "b";
+        case OP_CLOSURE:                 return "f";
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE:            return "bi";
+        case OP_REG_MOVE:                return "ll";
+        case OP_REG_LOAD_CONSTANT:       return "lk";
+        case OP_REG_ADD:
+        case OP_REG_SUBTRACT:
+        case OP_REG_MULTIPLY:
+        case OP_REG_DIVIDE:              return "lll";
+        case OP_REG_ADD_CONSTANT:
+        case OP_REG_SUBTRACT_CONSTANT:
+        case OP_REG_MULTIPLY_CONSTANT:
+        case OP_REG_DIVIDE_CONSTANT:     return "llk";
+        case OP_ADD_LOCALS:              return "ll";
+        case OP_ADD_LOCAL_CONSTANT:
+        case OP_SUBTRACT_LOCAL_CONSTANT: return "lk";
+        case OP_CONSTANT_LONG:           return "K";
+        case OP_GET_LOCAL_LONG:
+        case OP_SET_LOCAL_LONG:          return "L";
+        case OP_GET_UPVALUE_LONG:
+        case OP_SET_UPVALUE_LONG:        return "U";
+        case OP_CLOSURE_LONG:            return "F";
+        case OP_CLASS_LONG:
+        case OP_METHOD_LONG:
+        case OP_GET_SUPER_LONG:          return "S";
+        default:                         return NULL;
+    }
+}
+
+// everything code has to agree with to be safe to run
+typedef struct {
+    const FunctionRecord* record;
+    const FunctionRecord* functions;   // the records before this one, which its closures create
+    uint32_t              globalCount;
+} CodeContext;
+
+// checks one operand of kind at offset, returning its length in bytes, or 0 when it is out of range
+static int checkOperand (const CodeContext* context, char kind, uint32_t offset, uint32_t* jumpTarget) {
+    const FunctionRecord* record = context->record;
+    const uint8_t*        code   = record->code + offset;
+    int                   length = strchr("ksflub", kind) != NULL ? 1 : strchr("KSF", kind) != NULL ? 3 : 2;
+    if (offset + length > record->codeCount) return 0;
+
+    uint32_t operand = length == 1 ? code[0] : length == 2 ? (code[0] << 8) | code[1] : readLongOperand(code);
+    switch (kind) {
+        case 'k': case 'K': return operand < record->constantCount ? length : 0;
+        case 's': case 'S':
+            return operand < record->constantCount && recordConstant(record, operand).tag == CONSTANT_STRING ? length : 0;
+        case 'f': case 'F':
+            return operand < record->constantCount && recordConstant(record, operand).tag == CONSTANT_FUNCTION ? length : 0;
+        case 'l': case 'L': return operand < record->maxSlots ? length : 0;
+        case 'u': case 'U': return operand < record->upvalueCount ? length : 0;
+        case 'g':           return operand < context->globalCount ? length : 0;
+        case 'c':           return operand < record->cacheCount ? length : 0;
+        case 'i':           return operand < record->invokeCacheCount ? length : 0;
+        case 'b':           return length;
+        case 'j':           *jumpTarget = offset + 2 + operand; return length;
+        case 'J':           *jumpTarget = offset + 2 - operand; return operand <= offset + 2 ? length : 0;
+        default:            return 0;
+    }
+}
+
+// checks the capture pairs after a CLOSURE whose function is record number function, returning their
+// length, or -1 when one is out of range
+static int checkCaptures (const CodeContext* context, uint32_t function, uint32_t offset) {
+    const FunctionRecord* record = context->record;
+    uint32_t              start  = offset;
+
+    for (uint32_t i = 0; i < context->functions[function].upvalueCount; i++) {
+        if (offset + 2 > record->codeCount) return -1;
+        uint8_t  flags = record->code[offset];
+        uint32_t index = record->code[offset + 1];
+        if (flags & ~(CAPTURE_LOCAL | CAPTURE_WIDE)) return -1;
+        if (flags & CAPTURE_WIDE) {
+            if (offset + 3 > record->codeCount) return -1;
+            index = (index << 8) | record->code[offset + 2];
+        }
+
+        if (index >= (flags & CAPTURE_LOCAL ? record->maxSlots : record->upvalueCount)) return -1;
+        offset += flags & CAPTURE_WIDE ? 3 : 2;
+    }
+    return offset - start;
+}
+
+// checks that a function's code decodes into whole instructions whose operands all name something that
+// exists, that every jump lands on the start of an instruction, and that it ends in a return
+static bool validCode (const CodeContext* context) {
+    const FunctionRecord* record  = context->record;
+    uint32_t              count   = record->codeCount;
+    bool*                 starts  = (bool*)calloc(count + 1, sizeof(bool));
+    uint32_t*             targets = (uint32_t*)malloc(sizeof(uint32_t) * (count + 1));
+    if (starts == NULL || targets == NULL) exit(1);
+
+    bool     valid       = count > 0;
+    uint32_t targetCount = 0;
+    uint32_t last        = 0;
+    uint32_t offset      = 0;
+    while (valid && offset < count) {
+        starts[offset] = true;
+        last           = offset;
+
+        uint8_t     instruction = record->code[offset];
+        const char* kinds       = operandKinds(instruction);
+        uint32_t    next        = offset + 1;
+
+        if (instruction == OP_LONG_JUMP) {
+            // the kind of jump it stands for, then a 24-bit distance
+            const char* inner = next < count ? operandKinds(record->code[next]) : NULL;
+            valid = inner != NULL && (inner[0] == 'j' || inner[0] == 'J') && next + 4 <= count;
+            if (valid) {
+                uint32_t distance = readLongOperand(record->code + next + 1);
+                next += 4;
+                if (inner[0] == 'J') valid = distance <= next;
+                targets[targetCount++] = inner[0] == 'J' ? next - distance : next + distance;
+            }
+            offset = next;
+            continue;
+        }
+
+        valid = kinds != NULL;
+        for (const char* kind = kinds; valid && *kind != '\0'; kind++) {
+            uint32_t target = UINT32_MAX;
+            int      length = checkOperand(context, *kind, next, &target);
+            valid = length > 0;
+            if (target != UINT32_MAX) targets[targetCount++] = target;
+
+            if (valid && (*kind == 'f' || *kind == 'F')) {
+                uint32_t constant = *kind == 'f' ? record->code[next] : readLongOperand(record->code + next);
+                int      captures = checkCaptures(context, recordConstant(record, constant).index, next + length);
+                valid   = captures >= 0;
+                length += captures;
+            }
+            next += length;
+        }
+        offset = next;
+    }
+
+    valid = valid && offset == count && record->code[last] == OP_RETURN;
+    for (uint32_t i = 0; valid && i < targetCount; i++) valid = targets[i] < count && starts[targets[i]];
+
+    free(starts);
+    free(targets);
+    return valid;
+}
+
+// checks a whole .loxc image before anything is built from it, filling in where its strings and function
+// records live. a file that fails any check is simply recompiled
+static bool validImage (Reader* reader, uint64_t sourceHash, BytecodeHeader* header, StringRecord** strings,
+                        const uint8_t** globals, FunctionRecord** functions) {
+    const uint8_t* bytes = readBytes(reader, sizeof(BytecodeHeader));
+    if (bytes == NULL) return false;
+    memcpy(header, bytes, sizeof(BytecodeHeader));
+
+    size_t size = reader->end - reader->start;
+    if (memcmp(header->magic, BYTECODE_MAGIC, sizeof(header->magic)) != 0) return false;
+    if (header->version != BYTECODE_VERSION || header->sourceHash != sourceHash) return false;
+    if (header->size != size || header->reserved != 0 || header->functionCount == 0) return false;
+    // the checks below keep a damaged file from breaking the VM; only the hash catches a changed string or number
+    const uint8_t* image = reader->start + sizeof(BytecodeHeader);
+    if (hashBytes(HASH_SEED, image, size - sizeof(BytecodeHeader)) != header->imageHash) return false;
+    // every entry takes at least four bytes, which bounds the counts before anything is allocated for them
+    if (header->stringCount > size / 4 || header->functionCount > size / 32) return false;
+    if (header->globalCount > size / 4 || header->globalCount > UINT16_MAX + 1) return false;
+
+    *strings   = (StringRecord*)malloc(sizeof(StringRecord) * (header->stringCount + 1));
+    *functions = (FunctionRecord*)malloc(sizeof(FunctionRecord) * header->functionCount);
+    if (*strings == NULL || *functions == NULL) exit(1);
+
+    for (uint32_t i = 0; i < header->stringCount; i++) {
+        (*strings)[i].length = readU32(reader);
+        (*strings)[i].chars  = (const char*)readBytes(reader, (*strings)[i].length);
+        skipPadding(reader);
+        if (!reader->ok || (*strings)[i].length > INT32_MAX) return false;
+    }
+
+    *globals = readBytes(reader, (size_t)header->globalCount * sizeof(uint32_t));
+    for (uint32_t i = 0; reader->ok && i < header->globalCount; i++) {
+        if (arrayU32(*globals, i) >= header->stringCount) return false;
+    }
+
+    for (uint32_t i = 0; i < header->functionCount; i++) {
+        FunctionRecord* record = &(*functions)[i];
+        if (!readFunctionRecord(reader, record)) return false;
+        if (record->arity > 255 || record->upvalueCount > UINT16_MAX + 1) return false;
+        if (record->maxSlots < record->arity + 1 || record->maxSlots > UINT24_MAX) return false;
+        if (record->name != NO_NAME && record->name >= header->stringCount) return false;
+
+        // the runs start at the first byte and move strictly forward through the code
+        if (record->lineCount == 0 || record->lineCount > record->codeCount) return false;
+        for (uint32_t j = 0; j < record->lineCount; j++) {
+            uint32_t offset = arrayU32(record->lines, 2 * j);
+            if (j == 0 ? offset != 0 : offset <= arrayU32(record->lines, 2 * j - 2)) return false;
+            if (offset >= record->codeCount || arrayU32(record->lines, 2 * j + 1) > INT32_MAX) return false;
+        }
+
+        // a function constant can only name a record that came before
+        for (uint32_t j = 0; j < record->constantCount; j++) {
+            BytecodeConstant constant = recordConstant(record, j);
+            if (constant.tag == CONSTANT_STRING && constant.index >= header->stringCount) return false;
+            if (constant.tag == CONSTANT_FUNCTION && constant.index >= i) return false;
+            if (constant.tag > CONSTANT_FUNCTION) return false;
+        }
+        for (uint32_t j = 0; j < record->cacheCount; j++) {
+            if (arrayU32(record->cacheNames, j) >= header->stringCount) return false;
+        }
+        for (uint32_t j = 0; j < record->invokeCacheCount; j++) {
+            if (arrayU32(record->invokeCacheNames, j) >= header->stringCount) return false;
+        }
+
+        CodeContext context = { record, *functions, header->globalCount };
+        if (!validCode(&context)) return false;
+    }
+
+    FunctionRecord* script = &(*functions)[header->functionCount - 1];
+    return reader->current == reader->end && script->arity == 0 && script->upvalueCount == 0;
+}
+
+// builds the function tree of a validated image. the strings and functions go into the constant table of
+// a holder function on the stack as they are made, which keeps them all reachable until the script is
+// returned. globals are looked up by name, and the code is re-pointed at the slots they got in this VM.
+// NULL when a function's stack use doesn't add up
+static ObjFunction* buildImage (const BytecodeHeader* header, const StringRecord* strings, const uint8_t* globals,
+                                const FunctionRecord* functions) {
+    bool         valid  = true;
+    ObjFunction* holder = newFunction();
+    push(OBJ_VAL(holder));
+    ValueArray* made = &holder->chunk.constants;
+
+    for (uint32_t i = 0; i < header->stringCount; i++) {
+        push(OBJ_VAL(copyLiteral(strings[i].chars, (int)strings[i].length)));
+        writeValueArray(made, vm.stackTop[-1]);
+        pop();
+    }
+
+    for (uint32_t i = 0; i < header->functionCount; i++) {
+        const FunctionRecord* record   = &functions[i];
+        ObjFunction*          function = newFunction();
+        push(OBJ_VAL(function));
+        writeValueArray(made, OBJ_VAL(function));
+        pop();
+
+        function->arity        = record->arity;
+        function->upvalueCount = record->upvalueCount;
+        function->maxSlots     = record->maxSlots;
+        function->name         = record->name == NO_NAME ? NULL : AS_STRING(made->values[record->name]);
+        writeBarrier((Obj*)function, (Obj*)function->name);
+
+        Chunk*     chunk = &function->chunk;
+        uint8_t*   code  = ALLOCATE(uint8_t, record->codeCount);
+        LineStart* lines = ALLOCATE(LineStart, record->lineCount);
+        memcpy(code, record->code, record->codeCount);
+        for (uint32_t j = 0; j < record->lineCount; j++) {
+            lines[j].offset = (int)arrayU32(record->lines, 2 * j);
+            lines[j].line   = (int)arrayU32(record->lines, 2 * j + 1);
+        }
+        chunk->code         = code;
+        chunk->count        = record->codeCount;
+        chunk->capacity     = record->codeCount;
+        chunk->lines        = lines;
+        chunk->lineCount    = record->lineCount;
+        chunk->lineCapacity = record->lineCount;
+
+        for (uint32_t j = 0; j < record->constantCount; j++) {
+            BytecodeConstant constant = recordConstant(record, j);
+            Value            value;
+            if (constant.tag == CONSTANT_STRING)        value = made->values[constant.index];
+            else if (constant.tag == CONSTANT_FUNCTION) value = made->values[header->stringCount + constant.index];
+            else {
+                double number;
+                memcpy(&number, &constant.bits, sizeof(number));
+                value = NUMBER_VAL(number);
+            }
+            writeValueArray(&chunk->constants, value);
+        }
+
+        for (uint32_t j = 0; j < record->cacheCount; j++) {
+            addCache(chunk, AS_STRING(made->values[arrayU32(record->cacheNames, j)]));
+            writeBarrier((Obj*)function, (Obj*)chunk->caches[j].name);
+        }
+        for (uint32_t j = 0; j < record->invokeCacheCount; j++) {
+            addInvokeCache(chunk, AS_STRING(made->values[arrayU32(record->invokeCacheNames, j)]));
+            writeBarrier((Obj*)function, (Obj*)chunk->invokeCaches[j].name);
+        }
+
+        // the VM sizes the stack for a call from maxSlots, so it has to cover the deepest the code goes, and
+        // nothing may pop below the values the frame started with
+        bool balanced = true;
+        valid = valid && maxStackDepth(chunk, function->arity + 1, &balanced) <= function->maxSlots && balanced;
+    }
+
+    // the slot each saved global has in this VM; natives and globals are normally assigned in the same
+    // order as when the file was written, so the code rarely needs touching
+    int* slots = (int*)malloc(sizeof(int) * (header->globalCount + 1));
+    if (slots == NULL) exit(1);
+    bool moved = false;
+    for (uint32_t i = 0; i < header->globalCount; i++) {
+        slots[i] = globalSlot(AS_STRING(made->values[arrayU32(globals, i)]));
+        moved    = moved || slots[i] != (int)i;
+        valid    = valid && slots[i] <= UINT16_MAX;
+    }
+
+    for (uint32_t i = 0; moved && valid && i < header->functionCount; i++) {
+        Chunk* chunk = &AS_FUNCTION(made->values[header->stringCount + i])->chunk;
+        for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+            uint8_t instruction = chunk->code[offset];
+            if (instruction != OP_GET_GLOBAL && instruction != OP_SET_GLOBAL && instruction != OP_DEFINE_GLOBAL) continue;
+
+            int slot = slots[(chunk->code[offset + 1] << 8) | chunk->code[offset + 2]];
+            chunk->code[offset + 1] = (slot >> 8) & 0xff;
+            chunk->code[offset + 2] = slot & 0xff;
+        }
+    }
+    free(slots);
+
+    ObjFunction* script = AS_FUNCTION(made->values[header->stringCount + header->functionCount - 1]);
+    pop();
+    return valid ? script : NULL;
+}
+
+// maps the .loxc file at path and returns the script it holds, or NULL when there is no such file, it was
+// compiled from different source or by a different build, or it fails validation
+ObjFunction* loadBytecode (const char* path, uint64_t sourceHash) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(BytecodeHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size   = (size_t)info.st_size;
+    void*  mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) return NULL;
+
+    Reader reader = { (const uint8_t*)mapped, (const uint8_t*)mapped, (const uint8_t*)mapped + size, true };
+
+    BytecodeHeader  header;
+    StringRecord*   strings   = NULL;
+    const uint8_t*  globals   = NULL;
+    FunctionRecord* functions = NULL;
+    ObjFunction*    script    = NULL;
+    if (validImage(&reader, sourceHash, &header, &strings, &globals, &functions)) {
+        script = buildImage(&header, strings, globals, functions);
+    }
+
+    free(strings);
+    free(functions);
+    munmap(mapped, size);
+    return script;
+}
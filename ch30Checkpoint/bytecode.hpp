@@ -0,0 +1,13 @@
+#ifndef clox_bytecode_hpp
+#define clox_bytecode_hpp
+
+#include "object.hpp"
+
+// bumped whenever the instruction set or the file layout changes, so older .loxc files are recompiled
+#define BYTECODE_VERSION 3
+
+uint64_t     hashSource   (const char* source, size_t length);
+bool         saveBytecode (ObjFunction* script, uint64_t sourceHash, const char* path);
+ObjFunction* loadBytecode (const char* path, uint64_t sourceHash);
+
+#endif
@@ -10,14 +10,25 @@ void initChunk (Chunk* chunk) {
     chunk->capacity = 0;
     chunk->code = NULL;
     chunk->lines = NULL;
+    chunk->lineCount = 0;
+    chunk->lineCapacity = 0;
     initValueArray(&chunk->constants);
+    chunk->cacheCount = 0;
+    chunk->cacheCapacity = 0;
+    chunk->caches = NULL;
+    chunk->invokeCacheCount = 0;
+    chunk->invokeCacheCapacity = 0;
+    chunk->invokeCaches = NULL;
 }
 
 // freeChunk is called when a chunk is destroyed
 void freeChunk (Chunk* chunk) {
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    // FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
     freeValueArray(&chunk->constants);
+    FREE_ARRAY(PropertyCache, chunk->caches, chunk->cacheCapacity);
+    FREE_ARRAY(InvokeCache, chunk->invokeCaches, chunk->invokeCacheCapacity);
     initChunk(chunk);
 }
 
@@ -28,18 +39,81 @@ void writeChunk (Chunk* chunk, uint8_t byte, int line) {
         int oldCap = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(oldCap);
         chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCap, chunk->capacity);
-        chunk->lines = GROW_ARRAY(int, chunk->lines, oldCap, chunk->capacity);
+        // chunk->lines = GROW_ARRAY(int, chunk->lines, oldCap, chunk->capacity);
     }
 
     chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
+    // chunk->lines[chunk->count] = line;
+    addLine(chunk, chunk->count, line);
     chunk->count++;
 }
 
+// records that the byte at offset came from line, starting a new run only when the line changes. the
+// compiler rewinds by cutting count short, so runs left over from past the new end are dropped here,
+// the next time a byte goes in after them
+void addLine (Chunk* chunk, int offset, int line) {
+    while (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].offset >= offset) chunk->lineCount--;
+    if (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].line == line) return;
+
+    if (chunk->lineCapacity < chunk->lineCount + 1) {
+        int oldCap = chunk->lineCapacity;
+        chunk->lineCapacity = GROW_CAPACITY(oldCap);
+        chunk->lines = GROW_ARRAY(LineStart, chunk->lines, oldCap, chunk->lineCapacity);
+    }
+
+    chunk->lines[chunk->lineCount].offset = offset;
+    chunk->lines[chunk->lineCount].line   = line;
+    chunk->lineCount++;
+}
+
+// returns the line the byte at offset came from: the line of the last run starting at or before it
+int getLine (Chunk* chunk, int offset) {
+    int low  = 0;
+    int high = chunk->lineCount - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (chunk->lines[mid].offset <= offset) low = mid;
+        else high = mid - 1;
+    }
+    return chunk->lineCount > 0 ? chunk->lines[low].line : 0;
+}
+
 // addConstant is called when a new constant is added to the chunk
 int addConstant(Chunk* chunk, Value value) {
     push(value); // added in ch26
     writeValueArray(&chunk->constants, value);
     pop();     // added in ch26
     return chunk->constants.count - 1;
+}
+
+// addCache reserves an empty inline cache for a property instruction and returns its index
+int addCache (Chunk* chunk, ObjString* name) {
+    if (chunk->cacheCapacity < chunk->cacheCount + 1) {
+        int oldCap = chunk->cacheCapacity;
+        chunk->cacheCapacity = GROW_CAPACITY(oldCap);
+        chunk->caches = GROW_ARRAY(PropertyCache, chunk->caches, oldCap, chunk->cacheCapacity);
+    }
+
+    PropertyCache* cache = &chunk->caches[chunk->cacheCount];
+    cache->name       = name;
+    cache->shape      = NULL;
+    cache->transition = NULL;
+    cache->slot       = -1;
+    cache->method     = NIL_VAL;
+    cache->misses     = 0;
+    return chunk->cacheCount++;
+}
+
+// addInvokeCache reserves an empty inline cache for an invoke instruction and returns its index
+int addInvokeCache (Chunk* chunk, ObjString* name) {
+    if (chunk->invokeCacheCapacity < chunk->invokeCacheCount + 1) {
+        int oldCap = chunk->invokeCacheCapacity;
+        chunk->invokeCacheCapacity = GROW_CAPACITY(oldCap);
+        chunk->invokeCaches = GROW_ARRAY(InvokeCache, chunk->invokeCaches, oldCap, chunk->invokeCacheCapacity);
+    }
+
+    InvokeCache* cache = &chunk->invokeCaches[chunk->invokeCacheCount];
+    cache->name  = name;
+    cache->count = 0;
+    return chunk->invokeCacheCount++;
 }
\ No newline at end of file
@@ -42,22 +42,129 @@ typedef enum { // each instruction has an opcode
     OP_RETURN,
     OP_CLASS,         // added in ch27
     OP_INHERIT,       // added in ch29
-    OP_METHOD         // added in ch28
+    OP_METHOD,        // added in ch28
+
+    // three-address register ops: operands name frame slots directly instead of going through the stack
+    OP_REG_MOVE,              // dst src
+    OP_REG_LOAD_CONSTANT,     // dst constant
+    OP_REG_ADD,               // dst a b
+    OP_REG_SUBTRACT,          // dst a b
+    OP_REG_MULTIPLY,          // dst a b
+    OP_REG_DIVIDE,            // dst a b
+    OP_REG_ADD_CONSTANT,      // dst a constant
+    OP_REG_SUBTRACT_CONSTANT, // dst a constant
+    OP_REG_MULTIPLY_CONSTANT, // dst a constant
+    OP_REG_DIVIDE_CONSTANT,   // dst a constant
+
+    // superinstructions written by the optimizer pass over a finished chunk
+    OP_ADD_LOCALS,              // a b:        GET_LOCAL a, GET_LOCAL b, ADD
+    OP_ADD_LOCAL_CONSTANT,      // a constant: GET_LOCAL a, CONSTANT, ADD
+    OP_SUBTRACT_LOCAL_CONSTANT, // a constant: GET_LOCAL a, CONSTANT, SUBTRACT
+    OP_SET_LOCAL_POP,           // a:          SET_LOCAL a, POP
+    OP_GET_THIS_PROPERTY,       // cache:      GET_LOCAL 0, GET_PROPERTY
+    OP_POPN,                    // n:          a run of n POPs
+
+    // conditional jumps that consume their operands: compare-and-branch for conditions and loops, and the
+    // short-circuit forms used by `and` / `or`
+    OP_POP_JUMP_IF_FALSE,
+    OP_POP_JUMP_IF_TRUE,        // only written by the optimizer, for NOT, POP_JUMP_IF_FALSE
+    OP_JUMP_IF_FALSE_OR_POP,
+    OP_JUMP_IF_TRUE_OR_POP,
+    OP_JUMP_IF_NOT_LESS,
+    OP_JUMP_IF_LESS,
+    OP_JUMP_IF_NOT_GREATER,
+    OP_JUMP_IF_GREATER,
+    OP_JUMP_IF_NOT_EQUAL,
+    OP_JUMP_IF_EQUAL,
+
+    // quickened number-only forms that run() swaps in for ADD, SUBTRACT, LESS and GREATER at runtime
+    OP_ADD_NUMBER,
+    OP_SUBTRACT_NUMBER,
+    OP_LESS_NUMBER,
+    OP_GREATER_NUMBER,
+
+    OP_TAIL_CALL, // argCount: a call in return position, run in the caller's frame instead of a new one
+
+    // wide forms the compiler falls back on only when an operand outgrows the compact encoding above
+    OP_CONSTANT_LONG,    // constant (24-bit)
+    OP_GET_LOCAL_LONG,   // slot (16-bit)
+    OP_SET_LOCAL_LONG,   // slot (16-bit)
+    OP_GET_UPVALUE_LONG, // index (16-bit)
+    OP_SET_UPVALUE_LONG, // index (16-bit)
+    OP_CLOSURE_LONG,     // constant (24-bit), then the capture pairs as for CLOSURE
+    OP_CLASS_LONG,       // name constant (24-bit)
+    OP_METHOD_LONG,      // name constant (24-bit)
+    OP_GET_SUPER_LONG,   // name constant (24-bit)
+    OP_LONG_JUMP         // kind distance (24-bit): a jump of opcode kind whose distance outgrew 16 bits
 } OpCode;
 
-// chunk struct is used to store the bytecode
+#define UINT24_MAX 0xffffff
+
+// a CLOSURE capture pair is a flag byte and an index byte; an index past UINT8_MAX sets CAPTURE_WIDE in
+// the flags and takes two bytes instead
+#define CAPTURE_LOCAL 0x01
+#define CAPTURE_WIDE  0x02
+
+// reads the 24-bit operand of a wide instruction, high byte first
+static inline int readLongOperand (const uint8_t* code) { return (code[0] << 16) | (code[1] << 8) | code[2]; }
+
+struct ObjShape;
+
+// inline cache behind one property instruction, filled on a miss in run() and valid while the receiver's
+// shape matches
 typedef struct {
+    ObjString*       name;       // property the instruction reads or writes
+    struct ObjShape* shape;      // receiver shape the entry was filled for, NULL while empty
+    struct ObjShape* transition; // SET_PROPERTY adding a field: the shape the receiver moves to
+    int              slot;       // field slot, or -1 when the name resolved to a method
+    Value            method;     // closure to bind when it resolved to a method
+    int              misses;     // refills after the first; past a limit the site counts as megamorphic
+} PropertyCache;
+
+#define INVOKE_CACHE_SIZE 4
+
+// polymorphic inline cache behind one INVOKE or SUPER_INVOKE, holding the method resolved for up to
+// INVOKE_CACHE_SIZE receiver shapes (or superclasses). a shape only ever belongs to one class, and a
+// class's methods are all in place before anything can invoke them, so an entry never goes stale
+typedef struct {
+    ObjString* name;                     // method the instruction invokes
+    Obj*       keys[INVOKE_CACHE_SIZE];
+    Value      methods[INVOKE_CACHE_SIZE];
     int        count;
-    int        capacity;
-    uint8_t*   code;
-    int*       lines;
-    ValueArray constants;
+} InvokeCache;
+
+// one run of the line table: the bytes from offset up to the next run's offset all came from line
+typedef struct {
+    int offset;
+    int line;
+} LineStart;
+
+// chunk struct is used to store the bytecode
+typedef struct {
+    int            count;
+    int            capacity;
+    uint8_t*       code;
+    // int*        lines;
+    LineStart*     lines;        // a new run only when the line changes, so one entry per source line
+    int            lineCount;
+    int            lineCapacity;
+    ValueArray     constants;
+    int            cacheCount;
+    int            cacheCapacity;
+    PropertyCache* caches;
+    int            invokeCacheCount;
+    int            invokeCacheCapacity;
+    InvokeCache*   invokeCaches;
 } Chunk;
 
 void initChunk   (Chunk* chunk);
 void freeChunk   (Chunk* chunk);
 // void writeChunk (Chunk* chunk, uint8_t byte);
 void writeChunk  (Chunk* chunk, uint8_t byte, int line);
+void addLine     (Chunk* chunk, int offset, int line);
+int  getLine     (Chunk* chunk, int offset);
 int  addConstant (Chunk* chunk, Value value);
+int  addCache    (Chunk* chunk, ObjString* name);
+int  addInvokeCache (Chunk* chunk, ObjString* name);
 
 #endif 
\ No newline at end of file
@@ -8,6 +8,14 @@
 // nan-boxing is a technique for storing values in a single 64-bit word
 #define NAN_BOXING                  // added in ch30
 
+// threaded dispatch in run() relies on the labels-as-values extension; anything else falls back to the switch
+#if defined(__GNUC__) || defined(__clang__)
+    #define COMPUTED_GOTO
+#endif
+
+// compiles local-only assignments to three-address register ops; comment out to benchmark the pure stack VM
+#define REGISTER_VM
+
 // #define DEBUG_PRINT_CODE            // added in ch17
 
 // #define DEBUG_TRACE_EXECUTION       // added in ch15
@@ -15,6 +23,9 @@
 // #define DEBUG_STRESS_GC             // added in ch26
 // #define DEBUG_LOG_GC                // added in ch26
 
+// #define DEBUG_LOG_CACHE             // counts inline cache hits, misses and megamorphic lookups, printed by freeVM()
+// #define DEBUG_LOG_OPTIMIZER         // prints each function's code size before and after optimizeChunk()
+
 // this is a macro that will be used to print the line number and file name of the code that caused the error
 #define UINT8_COUNT (UINT8_MAX + 1) // added in ch22
 
@@ -7,6 +7,7 @@
 #include "compiler.hpp"
 #include "object.hpp" // added in ch19
 #include "memory.hpp" // added in ch26
+#include "optimizer.hpp"
 #include "scanner.hpp"
 
 #ifdef DEBUG_PRINT_CODE // added in ch17
@@ -55,10 +56,16 @@ typedef struct { // added in ch22
 
 // upvalue struct is for tracking variables from enclosing functions
 typedef struct { // added in ch25
-    uint8_t index;
-    bool    isLocal;
+    // uint8_t index;
+    uint16_t index;
+    bool     isLocal;
 } Upvalue;
 
+// locals and upvalues past the first 256 in a function are reached through the wide instructions, whose
+// two-byte operands set the limit
+#define LOCALS_MAX   (UINT16_MAX + 1)
+#define UPVALUES_MAX (UINT16_MAX + 1)
+
 // function type is for tracking whether the function is a script, function, or initializer
 typedef enum { // added in ch24
     TYPE_FUNCTION,
@@ -74,10 +81,30 @@ typedef struct Compiler {          // modified in ch24
     ObjFunction*     function;     // added in ch24
     FunctionType     type;         // added in ch24
 
-    Local   locals[UINT8_COUNT];
-    int     localCount;
-    Upvalue upvalues[UINT8_COUNT]; // added in ch25
-    int     scopeDepth;
+    // Local   locals[UINT8_COUNT];
+    // Upvalue upvalues[UINT8_COUNT]; // added in ch25
+    Local*   locals;
+    int      localCount;
+    int      localCapacity;
+    Upvalue* upvalues;
+    int      upvalueCapacity;
+    int      scopeDepth;
+
+    int     lastOperator;          // offset of the operator binary() emitted last
+    int     lastCall;              // offset of the OP_CALL call() emitted last
+    int     constantStart;         // span of the literal load emitted last, which an operator applied
+    int     constantEnd;           // to it can fold away
+    int     constantCount;         // size of the constant table before that load, which a fold cuts it back to
+    int     lastJumpTarget;        // offset patchJump() last landed a jump on
+    bool    terminated;            // whether the statement compiled last never carries on to the next one
+
+    int*    constantIndex;         // open-addressed hash of the constant table slots holding numbers and
+    int     constantIndexCount;    // strings, so a repeated literal or name reuses its slot; -1 is empty
+    int     constantIndexCapacity;
+
+    FarJump* farJumps;             // jumps emitted too far for their operand, left for optimizeChunk()
+    int      farJumpCount;
+    int      farJumpCapacity;
 } Compiler;
 
 // class compiler struct is for tracking the state of the class compiler
@@ -151,12 +178,29 @@ static bool matchType (TokenType type) { // added in ch21
 static void emitByte (uint8_t byte) { writeChunk(currChunk(), byte, parser.previous.line); } // added in ch17
 static void emitTwoBytes (uint8_t byte1, uint8_t byte2) { emitByte(byte1); emitByte(byte2); }   // added in ch17
 
+// records a jump at offset at whose distance to target doesn't fit its operand, for optimizeChunk() to widen
+static void addFarJump (int at, int target) {
+    if (current->farJumpCount + 1 > current->farJumpCapacity) {
+        int oldCapacity = current->farJumpCapacity;
+        current->farJumpCapacity = GROW_CAPACITY(oldCapacity);
+        current->farJumps = GROW_ARRAY(FarJump, current->farJumps, oldCapacity, current->farJumpCapacity);
+    }
+
+    current->farJumps[current->farJumpCount++] = FarJump{ at, target };
+}
+
 // appending loop to curr chunk
 static void emitLoop (int loopStart) {                                                          // added in ch23
+    int at = currChunk()->count;
     emitByte(OP_LOOP);
 
     int offset = currChunk()->count - loopStart + 2;
-    if (offset > UINT16_MAX) error("Loop body too large.");
+    // if (offset > UINT16_MAX) error("Loop body too large.");
+    if (offset > UINT24_MAX) error("Loop body too large.");
+    else if (offset > UINT16_MAX) {
+        addFarJump(at, loopStart);
+        offset = 0;
+    }
 
     emitTwoBytes((offset >> 8) & 0xff, offset & 0xff);
 }
@@ -176,29 +220,308 @@ static void emitReturn () {
     emitByte(OP_RETURN); 
 }                                              
 
+// returns the bits that identify a literal exactly: a number's bit pattern, so 0 and -0 stay apart, or
+// an interned string's pointer
+static uint64_t constantBits (Value value) {
+    #ifdef NAN_BOXING
+    return value;
+    #else
+    if (!IS_NUMBER(value)) return (uint64_t)(uintptr_t)AS_OBJ(value);
+    uint64_t bits;
+    memcpy(&bits, &AS_NUMBER(value), sizeof(bits));
+    return bits;
+    #endif
+}
+
+// mixes the bits of a constant into an index hash
+static uint32_t hashConstant (uint64_t bits) {
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+// returns the constant index entry holding the slot of value, or the empty entry it would go in. entries
+// left behind by rewindChunk() name a slot past the end of the table or one now holding something else,
+// so every hit is checked against the table itself
+static int* findConstant (Value value) {
+    ValueArray* constants = &currChunk()->constants;
+    uint64_t    bits      = constantBits(value);
+    uint32_t    mask      = current->constantIndexCapacity - 1;
+
+    for (uint32_t i = hashConstant(bits) & mask; ; i = (i + 1) & mask) {
+        int* entry = &current->constantIndex[i];
+        if (*entry == -1) return entry;
+        if (*entry >= constants->count) continue;
+
+        Value existing = constants->values[*entry];
+        if (IS_NUMBER(existing) == IS_NUMBER(value) && constantBits(existing) == bits) return entry;
+    }
+}
+
+// doubles the constant index, keeping only the entries that still name a live slot
+static void growConstantIndex () {
+    int* oldIndex    = current->constantIndex;
+    int  oldCapacity = current->constantIndexCapacity;
+
+    current->constantIndexCapacity = GROW_CAPACITY(oldCapacity);
+    current->constantIndex         = ALLOCATE(int, current->constantIndexCapacity);
+    current->constantIndexCount    = 0;
+    for (int i = 0; i < current->constantIndexCapacity; i++) current->constantIndex[i] = -1;
+
+    ValueArray* constants = &currChunk()->constants;
+    for (int i = 0; i < oldCapacity; i++) {
+        int slot = oldIndex[i];
+        if (slot == -1 || slot >= constants->count) continue;
+
+        int* entry = findConstant(constants->values[slot]);
+        if (*entry == -1) current->constantIndexCount++;
+        *entry = slot;
+    }
+
+    FREE_ARRAY(int, oldIndex, oldCapacity);
+}
+
+// returns the constant table slot holding a number or string, adding it the first time it comes up
+static int internConstant (Value value) {
+    if (current->constantIndexCount + 1 > current->constantIndexCapacity * 3 / 4) {
+        push(value); // a freshly copied name isn't reachable from anywhere else yet
+        growConstantIndex();
+        pop();
+    }
+
+    int* entry = findConstant(value);
+    if (*entry != -1) return *entry;
+
+    *entry = addConstant(currChunk(), value);
+    current->constantIndexCount++;
+    return *entry;
+}
+
 // converts value to constant and adds it to the chunk
-static uint8_t makeConstant (Value value) {                                                     // added in ch17
-    int constant = addConstant(currChunk(), value);
-    if (constant > UINT8_MAX) {
+// static uint8_t makeConstant (Value value) {                                                  // added in ch17
+static int makeConstant (Value value) {
+    // int constant = addConstant(currChunk(), value);
+    int constant = IS_NUMBER(value) || IS_STRING(value) ? internConstant(value) : addConstant(currChunk(), value);
+    // if (constant > UINT8_MAX) {
+    if (constant > UINT24_MAX) {
         error("Too many constants in one chunk.");
         return 0;
     }
 
-    return (uint8_t)constant;
+    return constant;
+}
+
+// emits an instruction that takes a constant table index, switching to its wide form past the first 256
+static void emitConstantOp (uint8_t instruction, uint8_t longInstruction, int constant) {
+    if (constant <= UINT8_MAX) {
+        emitTwoBytes(instruction, (uint8_t)constant);
+        return;
+    }
+
+    emitTwoBytes(longInstruction, (constant >> 16) & 0xff);
+    emitTwoBytes((constant >> 8) & 0xff, constant & 0xff);
+}
+
+// reserves an inline cache for the property called name in the current chunk and emits its index as a
+// two-byte operand; the cache holds the name, so the instruction needs no constant for it
+static void emitCache (Token* name) {
+    ObjString* string = copyLiteral(name->start, name->length);
+    push(OBJ_VAL(string)); // nothing else holds the name until the cache does
+    int cache = addCache(currChunk(), string);
+    writeBarrier((Obj*)current->function, (Obj*)string);
+    pop();
+
+    if (cache > UINT16_MAX) error("Too many property accesses in one chunk.");
+    emitTwoBytes((cache >> 8) & 0xff, cache & 0xff);
+}
+
+// same for the polymorphic cache behind an invoke instruction
+static void emitInvokeCache (Token* name) {
+    ObjString* string = copyLiteral(name->start, name->length);
+    push(OBJ_VAL(string));
+    int cache = addInvokeCache(currChunk(), string);
+    writeBarrier((Obj*)current->function, (Obj*)string);
+    pop();
+
+    if (cache > UINT16_MAX) error("Too many method calls in one chunk.");
+    emitTwoBytes((cache >> 8) & 0xff, cache & 0xff);
 }
 
 // emits a constant instruction
-static void emitConstant (Value value) { emitTwoBytes(OP_CONSTANT, makeConstant(value)); }        // added in ch17
+// static void emitConstant (Value value) { emitTwoBytes(OP_CONSTANT, makeConstant(value)); }     // added in ch17
+static void emitConstant (Value value) {
+    current->constantCount = currChunk()->constants.count;
+    int constant = makeConstant(value);
+    current->constantStart = currChunk()->count;
+    emitConstantOp(OP_CONSTANT, OP_CONSTANT_LONG, constant);
+    current->constantEnd = currChunk()->count;
+}
+
+// reads the value of the expression just compiled when it is nothing but a literal load; a jump landing
+// at the end means some path got here without running it
+static bool foldableConstant (int start, Value* value) {
+    Chunk* chunk = currChunk();
+    if (current->constantStart != start || current->constantEnd != chunk->count) return false;
+    if (current->lastJumpTarget == chunk->count) return false;
+
+    uint8_t* code = chunk->code + start;
+    switch (code[0]) {
+        case OP_CONSTANT:      *value = chunk->constants.values[code[1]];                   return true;
+        case OP_CONSTANT_LONG: *value = chunk->constants.values[readLongOperand(code + 1)]; return true;
+        case OP_NIL:           *value = NIL_VAL;                                            return true;
+        case OP_TRUE:          *value = BOOL_VAL(true);                                     return true;
+        case OP_FALSE:         *value = BOOL_VAL(false);                                    return true;
+        default:               return false;
+    }
+}
+
+// replaces the literal loads from start on with a load of value; booleans get their own opcodes rather
+// than a constant table entry. the operands' constants go with them, back to where the constant table
+// stood before the left one's load
+static void emitFolded (int start, int constantCount, Value value) {
+    currChunk()->count           = start;
+    currChunk()->constants.count = constantCount;
+    current->lastOperator        = -1;
+    if (!IS_BOOL(value)) {
+        emitConstant(value);
+        return;
+    }
+
+    current->constantStart = start;
+    current->constantCount = constantCount;
+    emitByte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    current->constantEnd = currChunk()->count;
+}
+
+// how far the current chunk had got before code that can never run, so it can be cut back to there
+typedef struct {
+    int count;
+    int constantCount;
+    int cacheCount;
+    int invokeCacheCount;
+} ChunkMark;
+
+// marks the current end of the chunk
+static ChunkMark markChunk () {
+    Chunk* chunk = currChunk();
+    return ChunkMark{ chunk->count, chunk->constants.count, chunk->cacheCount, chunk->invokeCacheCount };
+}
+
+// discards everything emitted since mark: code, lines, constants and inline caches. nothing live refers
+// to them, since only the discarded code did
+static void rewindChunk (ChunkMark mark) {
+    Chunk* chunk = currChunk();
+    chunk->count            = mark.count;
+    chunk->constants.count  = mark.constantCount;
+    chunk->cacheCount       = mark.cacheCount;
+    chunk->invokeCacheCount = mark.invokeCacheCount;
+
+    int kept = 0;
+    for (int i = 0; i < current->farJumpCount; i++) {
+        if (current->farJumps[i].at < mark.count) current->farJumps[kept++] = current->farJumps[i];
+    }
+    current->farJumpCount = kept;
+
+    current->lastOperator  = -1;
+    current->lastCall      = -1;
+    current->constantStart = -1;
+    current->constantEnd   = -1;
+}
+
+// returns whether a literal counts as false in a condition, the way run() decides it
+static bool isFalsey (Value value) { return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)); }
+
+// evaluates a binary operator on two literals the way run() would, returning false when the operands
+// have the wrong types so the operator is left for run() to report
+static bool foldBinary (TokenType operatorType, Value a, Value b, Value* result) {
+    switch (operatorType) {
+        case TOKEN_EQUAL_EQUAL: *result = BOOL_VAL(valuesEqual(a, b));  return true;
+        case TOKEN_BANG_EQUAL:  *result = BOOL_VAL(!valuesEqual(a, b)); return true;
+        default: break;
+    }
+
+    if (operatorType == TOKEN_PLUS && IS_STRING(a) && IS_STRING(b)) {
+        ObjString* left   = AS_STRING(a);
+        ObjString* right  = AS_STRING(b);
+        int        length = left->length + right->length;
+        char*      chars  = ALLOCATE(char, length + 1);
+        memcpy(chars, left->chars, left->length);
+        memcpy(chars + left->length, right->chars, right->length);
+        chars[length] = '\0';
+        *result = OBJ_VAL(takeString(chars, length));
+        return true;
+    }
+
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+
+    // >= and <= compile to the negated opposite comparison, which is what NaN operands see at runtime
+    switch (operatorType) {
+        case TOKEN_GREATER:       *result = BOOL_VAL(x > y);    return true;
+        case TOKEN_GREATER_EQUAL: *result = BOOL_VAL(!(x < y)); return true;
+        case TOKEN_LESS:          *result = BOOL_VAL(x < y);    return true;
+        case TOKEN_LESS_EQUAL:    *result = BOOL_VAL(!(x > y)); return true;
+        case TOKEN_PLUS:          *result = NUMBER_VAL(x + y);  return true;
+        case TOKEN_MINUS:         *result = NUMBER_VAL(x - y);  return true;
+        case TOKEN_STAR:          *result = NUMBER_VAL(x * y);  return true;
+        case TOKEN_SLASH:         *result = NUMBER_VAL(x / y);  return true;
+        default:                  return false;
+    }
+}
 
 // patches the jump offset
 static void patchJump (int offset) {                                                           // added in ch23
     // -2 to adjust for the bytecode for the jump offset itself.
     int jump = currChunk()->count - offset - 2;
 
-    if (jump > UINT16_MAX) error("Too much code to jump over.");
+    // if (jump > UINT16_MAX) error("Too much code to jump over.");
+    if (jump > UINT24_MAX) error("Too much code to jump over.");
+    else if (jump > UINT16_MAX) {
+        addFarJump(offset - 1, currChunk()->count);
+        jump = 0;
+    }
 
     currChunk()->code[offset] = (jump >> 8) & 0xff;
     currChunk()->code[offset + 1] = jump & 0xff;
+    current->lastJumpTarget = currChunk()->count;
+}
+
+// emits the jump over a statement body taken when the condition just compiled is false; the jump pops the
+// condition either way, and a trailing comparison is folded into it so no boolean is pushed just to branch on
+static int emitConditionJump () {
+    Chunk*  chunk       = currChunk();
+    int     compare     = current->lastOperator;
+    uint8_t instruction = OP_POP_JUMP_IF_FALSE;
+
+    // a jump landing right after the comparison (e.g. from `and`) expects a value to branch on there
+    if (compare >= 0 && current->lastJumpTarget != chunk->count) {
+        bool negated = compare == chunk->count - 2 && chunk->code[compare + 1] == OP_NOT;
+
+        if (negated || compare == chunk->count - 1) {
+            switch (chunk->code[compare]) {
+                case OP_LESS:    instruction = negated ? OP_JUMP_IF_LESS    : OP_JUMP_IF_NOT_LESS;    break;
+                case OP_GREATER: instruction = negated ? OP_JUMP_IF_GREATER : OP_JUMP_IF_NOT_GREATER; break;
+                case OP_EQUAL:   instruction = negated ? OP_JUMP_IF_EQUAL   : OP_JUMP_IF_NOT_EQUAL;   break;
+                default: break;
+            }
+            if (instruction != OP_POP_JUMP_IF_FALSE) chunk->count = compare;
+        }
+    }
+
+    return emitJump(instruction);
+}
+
+// claims the next local slot in the current compiler, growing the array as needed
+static Local* pushLocal () {
+    if (current->localCount + 1 > current->localCapacity) {
+        int oldCapacity = current->localCapacity;
+        current->localCapacity = GROW_CAPACITY(oldCapacity);
+        current->locals = GROW_ARRAY(Local, current->locals, oldCapacity, current->localCapacity);
+    }
+
+    return &current->locals[current->localCount++];
 }
 
 // initializes the compiler
@@ -207,14 +530,32 @@ static void initCompiler (Compiler* compiler, FunctionType type) {
     compiler->enclosing = current;      // added in ch24
     compiler->function = NULL;          // added in ch24
     compiler->type = type;              // added in ch24
+    compiler->locals = NULL;
     compiler->localCount = 0;
+    compiler->localCapacity = 0;
+    compiler->upvalues = NULL;
+    compiler->upvalueCapacity = 0;
     compiler->scopeDepth = 0;
+    compiler->lastOperator = -1;
+    compiler->lastCall = -1;
+    compiler->constantStart = -1;
+    compiler->constantEnd = -1;
+    compiler->lastJumpTarget = -1;
+    compiler->terminated = false;
+    compiler->constantIndex = NULL;
+    compiler->constantIndexCount = 0;
+    compiler->constantIndexCapacity = 0;
+    compiler->farJumps = NULL;
+    compiler->farJumpCount = 0;
+    compiler->farJumpCapacity = 0;
     compiler->function = newFunction(); // added in ch24
     current = compiler;
 
-    if (type != TYPE_SCRIPT) { current->function->name = copyString(parser.previous.start, parser.previous.length); }// added in ch24
+    if (type != TYPE_SCRIPT) { current->function->name = copyLiteral(parser.previous.start, parser.previous.length); }// added in ch24
+    if (type != TYPE_SCRIPT) { writeBarrier((Obj*)current->function, (Obj*)current->function->name); }
 
-    Local* local = &current->locals[current->localCount++]; // added in ch24
+    // Local* local = &current->locals[current->localCount++]; // added in ch24
+    Local* local = pushLocal();
     local->depth = 0;                                       // added in ch24
     local->isCaptured = false;                              // added in ch25
 
@@ -234,14 +575,30 @@ static void initCompiler (Compiler* compiler, FunctionType type) {
 static ObjFunction* endCompiler () {                                                           // modified in ch24
     emitReturn();
     ObjFunction* function = current->function; // added in ch24
+    if (!parser.hadError) {
+        #ifdef DEBUG_LOG_OPTIMIZER
+        int before = currChunk()->count;
+        #endif
+
+        optimizeChunk(currChunk(), current->farJumps, current->farJumpCount);
+        function->maxSlots = maxStackDepth(currChunk(), function->arity + 1);
+
+        #ifdef DEBUG_LOG_OPTIMIZER
+        printf("-- optimizer: %s %d -> %d bytes (%d removed)\n", function->name != NULL ? function->name->chars : "<script>",
+               before, currChunk()->count, before - currChunk()->count);
+        #endif
+    }
 
     #ifdef DEBUG_PRINT_CODE
     if (!parser.hadError) {
         // disassembleChunk(currentChunk(), "code");
-        disassembleChunk(currentChunk(), function->name != NULL ? function->name->chars : "<script>"); // added in ch24
+        disassembleChunk(currChunk(), function->name != NULL ? function->name->chars : "<script>"); // added in ch24
     }
     #endif
 
+    FREE_ARRAY(int, current->constantIndex, current->constantIndexCapacity);
+    FREE_ARRAY(FarJump, current->farJumps, current->farJumpCapacity);
+    FREE_ARRAY(Local, current->locals, current->localCapacity);
     current = current->enclosing; // added in ch24
     return function;              // added in ch24
 }
@@ -270,7 +627,43 @@ static void parsePrecedence(Precedence precedence);
 // static void and_(bool canAssign);                                                           // added in ch23
 
 // makes an identifier constant
-static uint8_t identifierConstant(Token* name) { return makeConstant(OBJ_VAL(copyString(name->start, name->length))); } // added in ch21
+// static uint8_t identifierConstant(Token* name) { return makeConstant(OBJ_VAL(copyString(name->start, name->length))); } // added in ch21
+static int identifierConstant(Token* name) { return makeConstant(OBJ_VAL(copyLiteral(name->start, name->length))); }
+
+// resolves a global name to its slot in the VM's global array
+static int identifierGlobal (Token* name) {
+    int slot = globalSlot(copyLiteral(name->start, name->length));
+    if (slot > UINT16_MAX) {
+        error("Too many global variables.");
+        return 0;
+    }
+
+    return slot;
+}
+
+// emits an instruction that takes a local, upvalue or global operand; global slots take two bytes, and
+// locals and upvalues past the first 256 switch to the wide forms, which do too
+static void emitVariable (uint8_t instruction, int arg) {
+    bool wide = instruction == OP_GET_GLOBAL || instruction == OP_SET_GLOBAL || instruction == OP_DEFINE_GLOBAL;
+    if (!wide && arg > UINT8_MAX) {
+        wide = true;
+        switch (instruction) {
+            case OP_GET_LOCAL:   instruction = OP_GET_LOCAL_LONG;   break;
+            case OP_SET_LOCAL:   instruction = OP_SET_LOCAL_LONG;   break;
+            case OP_GET_UPVALUE: instruction = OP_GET_UPVALUE_LONG; break;
+            case OP_SET_UPVALUE: instruction = OP_SET_UPVALUE_LONG; break;
+            default: break;
+        }
+    }
+
+    if (wide) {
+        emitByte(instruction);
+        emitTwoBytes((arg >> 8) & 0xff, arg & 0xff);
+        return;
+    }
+
+    emitTwoBytes(instruction, (uint8_t)arg);
+}
 
 // determines if two ids are equal
 static bool areIdentifiersEqual (Token* a, Token* b) {                                         // added in ch22
@@ -292,7 +685,8 @@ static int resolveLocal (Compiler* compiler, Token* name) {
 }
 
 // adds an upvalue to the compiler
-static int addUpvalue (Compiler* compiler, uint8_t index, bool isLocal) {                      // added in ch25
+// static int addUpvalue (Compiler* compiler, uint8_t index, bool isLocal) {                   // added in ch25
+static int addUpvalue (Compiler* compiler, int index, bool isLocal) {
     int upvalueCount = compiler->function->upvalueCount;
 
     for (int i = 0; i < upvalueCount; i++) {
@@ -300,11 +694,18 @@ static int addUpvalue (Compiler* compiler, uint8_t index, bool isLocal) {
         if (upvalue->index == index && upvalue->isLocal == isLocal) return i; 
     }
 
-    if (upvalueCount == UINT8_COUNT) {
+    // if (upvalueCount == UINT8_COUNT) {
+    if (upvalueCount == UPVALUES_MAX) {
         error("Too many closure variables in function.");
         return 0;
     }
 
+    if (upvalueCount + 1 > compiler->upvalueCapacity) {
+        int oldCapacity = compiler->upvalueCapacity;
+        compiler->upvalueCapacity = GROW_CAPACITY(oldCapacity);
+        compiler->upvalues = GROW_ARRAY(Upvalue, compiler->upvalues, oldCapacity, compiler->upvalueCapacity);
+    }
+
     compiler->upvalues[upvalueCount].isLocal = isLocal;
     compiler->upvalues[upvalueCount].index = index;
     return compiler->function->upvalueCount++;
@@ -317,23 +718,25 @@ static int resolveUpvalue (Compiler* compiler, Token* name) {
     int local = resolveLocal(compiler->enclosing, name);
     if (local != -1) {
         compiler->enclosing->locals[local].isCaptured = true;
-        return addUpvalue(compiler, (uint8_t)local, true); 
+        return addUpvalue(compiler, local, true);
     }
 
     int upvalue = resolveUpvalue(compiler->enclosing, name);
-    if (upvalue != -1) return addUpvalue(compiler, (uint8_t)upvalue, false); 
+    if (upvalue != -1) return addUpvalue(compiler, upvalue, false);
 
     return -1;
 }
 
 // adds a local variable to the compiler
 static void addLocal (Token name) {                                                             // added in ch22
-    if (current->localCount == UINT8_COUNT) {
+    // if (current->localCount == UINT8_COUNT) {
+    if (current->localCount == LOCALS_MAX) {
         error("Too many local variables in function.");
         return;
     }
 
-    Local* local = &current->locals[current->localCount++];
+    // Local* local = &current->locals[current->localCount++];
+    Local* local = pushLocal();
     local->name = name;
     local->depth = -1;
     local->isCaptured = false; // added in ch25
@@ -355,13 +758,15 @@ static void declareVariable () {
 }
 
 // parses a variable
-static uint8_t parseVariable (const char* errorMessage) {                                     // added in ch21
+// static uint8_t parseVariable (const char* errorMessage) {                                  // added in ch21
+static int parseVariable (const char* errorMessage) {
     consumeToken(TOKEN_IDENTIFIER, errorMessage);
 
     declareVariable();                                                                        // added in ch22
     if (current->scopeDepth > 0) return 0;                                                    // added in ch22
 
-    return identifierConstant(&parser.previous);
+    // return identifierConstant(&parser.previous);
+    return identifierGlobal(&parser.previous);
 }
 
 // marks a variable as initialized
@@ -371,13 +776,14 @@ static void markInitialized () { // added in ch22
 } 
 
 // defines global variable
-static void defineVariable (uint8_t global) {                                                 // added in ch21
+// static void defineVariable (uint8_t global) {                                              // added in ch21
+static void defineVariable (int global) {
     if (current->scopeDepth > 0) {
         markInitialized();
         return;
     }
 
-    emitTwoBytes(OP_DEFINE_GLOBAL, global);
+    emitVariable(OP_DEFINE_GLOBAL, global);
 }
 
 // compiles argument list
@@ -397,8 +803,7 @@ static uint8_t argumentList () {
 
 // turns a logical and into a chunk of bytecode
 static void and_ (bool canAssign) {                                                           // added in ch23
-    int endJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);
+    int endJump = emitJump(OP_JUMP_IF_FALSE_OR_POP);
     parsePrecedence(PREC_AND);
     patchJump(endJump);
 }
@@ -407,10 +812,23 @@ static void and_ (bool canAssign) {
 // static void binary() {                                                                      // added in ch17
 static void binary (bool canAssign) {                                                          // modified in ch21
     TokenType operatorType = parser.previous.type;
+    Value     left, right, folded;
+    int       leftStart    = current->constantStart;
+    int       leftCount    = current->constantCount;
+    bool      leftConstant = foldableConstant(leftStart, &left);
+    int       rightStart   = currChunk()->count;
+
     // Compile the right operand.
     ParseRule* rule = getRule(operatorType);
     parsePrecedence((Precedence)(rule->precedence + 1));
 
+    // the literal operands stay in the constant table, which keeps them alive while folding allocates
+    if (leftConstant && foldableConstant(rightStart, &right) && foldBinary(operatorType, left, right, &folded)) {
+        emitFolded(leftStart, leftCount, folded);
+        return;
+    }
+
+    current->lastOperator = currChunk()->count;
     switch (operatorType) {
         case TOKEN_BANG_EQUAL:    emitTwoBytes(OP_EQUAL, OP_NOT);   break; // added in ch18
         case TOKEN_EQUAL_EQUAL:   emitByte(OP_EQUAL);               break; // added in ch18
@@ -429,35 +847,44 @@ static void binary (bool canAssign) {
 // compiles function call
 static void call (bool canAssign) {                                                             // added in ch24
     uint8_t argCount = argumentList();
+    current->lastCall = currChunk()->count;
     emitTwoBytes(OP_CALL, argCount);
 }
 
 // compiles a dot field access
 static void dot (bool canAssign) {                                                              // added in ch25
     consumeToken(TOKEN_IDENTIFIER, "Expect property name after '.'.");
-    uint8_t name = identifierConstant(&parser.previous);
+    // uint8_t name = identifierConstant(&parser.previous);
+    Token name = parser.previous;
 
     if (canAssign && matchType(TOKEN_EQUAL)) {
         expression();
-        emitTwoBytes(OP_SET_PROPERTY, name);
+        emitByte(OP_SET_PROPERTY);
+        emitCache(&name);
     } 
     else if (matchType(TOKEN_OPEN_PAREN)) { // added in ch28
         uint8_t argCount = argumentList();
-        emitTwoBytes(OP_INVOKE, name);
-        emitByte(argCount);
+        emitTwoBytes(OP_INVOKE, argCount);
+        emitInvokeCache(&name);
+    }
+    else {
+        emitByte(OP_GET_PROPERTY);
+        emitCache(&name);
     }
-    else { emitTwoBytes(OP_GET_PROPERTY, name); }
 }
 
 // compiles a literal expression
 // static void literal() {                                                                     // added in ch18
 static void literal (bool canAssign) {                                                         // modified in ch21
+    current->constantStart = currChunk()->count;
+    current->constantCount = currChunk()->constants.count;
     switch (parser.previous.type) {
         case TOKEN_FALSE: emitByte(OP_FALSE); break;
         case TOKEN_NIL:   emitByte(OP_NIL);   break;
         case TOKEN_TRUE:  emitByte(OP_TRUE);  break;
         default: return; // Unreachable.
     }
+    current->constantEnd = currChunk()->count;
 }
 
 // compiles a grouping expression
@@ -477,12 +904,7 @@ static void number (bool canAssign) {
 
 // compiles a logical or into a chunk of bytecode
 static void or_ (bool canAssign) {                                                              // added in ch23
-    int elseJump = emitJump(OP_JUMP_IF_FALSE);
-    int endJump  = emitJump(OP_JUMP);
-
-    patchJump(elseJump);
-    emitByte(OP_POP);
-
+    int endJump = emitJump(OP_JUMP_IF_TRUE_OR_POP);
     parsePrecedence(PREC_OR);
     patchJump(endJump);
 }
@@ -490,7 +912,8 @@ static void or_ (bool canAssign) {
 // compiles a string expression
 // static void string() {
 static void string (bool canAssign) {                                                          // modified in ch21
-  emitConstant(OBJ_VAL(copyString(parser.previous.start + 1, parser.previous.length - 2)));
+  // emitConstant(OBJ_VAL(copyString(parser.previous.start + 1, parser.previous.length - 2)));
+  emitConstant(OBJ_VAL(copyLiteral(parser.previous.start + 1, parser.previous.length - 2)));
 }
  
 // compiles a named var
@@ -509,7 +932,7 @@ static void namedVariable (Token name, bool canAssign) {
         setOp = OP_SET_UPVALUE;
     }
     else {
-        arg   = identifierConstant(&name);
+        arg   = identifierGlobal(&name);
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
     }
@@ -517,10 +940,10 @@ static void namedVariable (Token name, bool canAssign) {
     // if (matchType(TOKEN_EQUAL)) {
     if (canAssign && matchType(TOKEN_EQUAL)) {
         expression();
-        emitTwoBytes(setOp, (uint8_t)arg);                                                          // added in ch22
+        emitVariable(setOp, arg);
         // emitBytes(OP_SET_GLOBAL, arg);
     }
-    else /*emitBytes(OP_GET_GLOBAL, arg);*/ emitTwoBytes(getOp, (uint8_t)arg);                      // added in ch22
+    else /*emitBytes(OP_GET_GLOBAL, arg);*/ emitVariable(getOp, arg);
 
     // emitBytes(OP_GET_GLOBAL, arg);
 }
@@ -546,18 +969,20 @@ static void super_ (bool canAssign) {
 
     consumeToken(TOKEN_DOT, "Expect '.' after 'super'.");
     consumeToken(TOKEN_IDENTIFIER, "Expect superclass method name.");
-    uint8_t name = identifierConstant(&parser.previous);
+    // uint8_t name = identifierConstant(&parser.previous);
+    Token name = parser.previous;
 
     namedVariable(syntheticToken("this"), false);
     if (matchType(TOKEN_OPEN_PAREN)) {
         uint8_t argCount = argumentList();
         namedVariable(syntheticToken("super"), false);
-        emitTwoBytes(OP_SUPER_INVOKE, name);
-        emitByte(argCount);
+        emitTwoBytes(OP_SUPER_INVOKE, argCount);
+        emitInvokeCache(&name);
     } 
     else {
+        int constant = identifierConstant(&name);
         namedVariable(syntheticToken("super"), false);
-        emitTwoBytes(OP_GET_SUPER, name);
+        emitConstantOp(OP_GET_SUPER, OP_GET_SUPER_LONG, constant);
     }
 
     // namedVariable(syntheticToken("super"), false);
@@ -581,8 +1006,22 @@ static void unary (bool canAssign) {
 
     // Compile the operand.
     // expression();
+    int start     = currChunk()->count;
+    int constants = currChunk()->constants.count;
     parsePrecedence(PREC_UNARY);
 
+    Value operand;
+    if (foldableConstant(start, &operand)) {
+        if (operatorType == TOKEN_BANG) {
+            emitFolded(start, constants, BOOL_VAL(isFalsey(operand)));
+            return;
+        }
+        if (operatorType == TOKEN_MINUS && IS_NUMBER(operand)) {
+            emitFolded(start, constants, NUMBER_VAL(-AS_NUMBER(operand)));
+            return;
+        }
+    }
+
     // Emit the operator instruction.
     switch (operatorType) {
         case TOKEN_BANG:  emitByte(OP_NOT);    break; // added in ch18
@@ -667,8 +1106,25 @@ static void expression () {
 }
 
 // parses a block of code
-static void block () {                                                                          // added in ch22
-    while (!checkType(TOKEN_CLOSE_BRACE) && !checkType(TOKEN_EOF)) { declaration(); }                  
+// static void block () {                                                                       // added in ch22
+//     while (!checkType(TOKEN_CLOSE_BRACE) && !checkType(TOKEN_EOF)) { declaration(); }
+//
+//     consumeToken(TOKEN_CLOSE_BRACE, "Expect '}' after block.");
+// }
+static void block () {
+    current->terminated = false;
+
+    while (!checkType(TOKEN_CLOSE_BRACE) && !checkType(TOKEN_EOF)) {
+        declaration();
+
+        // whatever follows a return (or a loop that never exits) is still compiled for its errors, then dropped
+        if (current->terminated) {
+            ChunkMark mark = markChunk();
+            while (!checkType(TOKEN_CLOSE_BRACE) && !checkType(TOKEN_EOF)) { declaration(); }
+            rewindChunk(mark);
+            current->terminated = true;
+        }
+    }
 
     consumeToken(TOKEN_CLOSE_BRACE, "Expect '}' after block.");
 }
@@ -684,7 +1140,7 @@ static void function (FunctionType type) {
         do {
             current->function->arity++;
             if (current->function->arity > 255) errorAtCurrent("Can't have more than 255 parameters.");
-            uint8_t constant = parseVariable("Expect parameter name.");
+            int constant = parseVariable("Expect parameter name.");
             defineVariable(constant);
         } while (matchType(TOKEN_COMMA));
     }
@@ -694,18 +1150,28 @@ static void function (FunctionType type) {
     block();
 
     ObjFunction* function = endCompiler();
-    emitTwoBytes(OP_CLOSURE, makeConstant(OBJ_VAL(function))); // added in ch25
+    // emitTwoBytes(OP_CLOSURE, makeConstant(OBJ_VAL(function))); // added in ch25
     // emitBytes(OP_CONSTANT, makeConstant(OBJ_VAL(function)));
+    emitConstantOp(OP_CLOSURE, OP_CLOSURE_LONG, makeConstant(OBJ_VAL(function)));
 
     for (int i = 0; i < function->upvalueCount; i++) {
-        emitTwoBytes(compiler.upvalues[i].isLocal ? 1 : 0, compiler.upvalues[i].index);
+        // emitTwoBytes(compiler.upvalues[i].isLocal ? 1 : 0, compiler.upvalues[i].index);
+        Upvalue* upvalue = &compiler.upvalues[i];
+        uint8_t  flags   = upvalue->isLocal ? CAPTURE_LOCAL : 0;
+        if (upvalue->index > UINT8_MAX) {
+            emitTwoBytes(flags | CAPTURE_WIDE, (upvalue->index >> 8) & 0xff);
+            emitByte(upvalue->index & 0xff);
+        }
+        else { emitTwoBytes(flags, (uint8_t)upvalue->index); }
     }
+
+    FREE_ARRAY(Upvalue, compiler.upvalues, compiler.upvalueCapacity);
 }
 
 // parses a method
 static void method () {                                                                      // added in ch28
     consumeToken(TOKEN_IDENTIFIER, "Expect method name.");
-    uint8_t constant = identifierConstant(&parser.previous);
+    int constant = identifierConstant(&parser.previous);
 
     // FunctionType type = TYPE_FUNCTION;
     FunctionType type = TYPE_METHOD;
@@ -716,18 +1182,20 @@ static void method () {
 
     function(type);
 
-    emitTwoBytes(OP_METHOD, constant);
+    // emitTwoBytes(OP_METHOD, constant);
+    emitConstantOp(OP_METHOD, OP_METHOD_LONG, constant);
 }
 
 // compiles class dec 
 static void classDeclaration () {                                                            // added in ch27
     consumeToken(TOKEN_IDENTIFIER, "Expect class name.");
     Token className = parser.previous; // added in ch28
-    uint8_t nameConstant = identifierConstant(&parser.previous);
+    int nameConstant = identifierConstant(&parser.previous);
     declareVariable();
 
-    emitTwoBytes(OP_CLASS, nameConstant);
-    defineVariable(nameConstant);
+    // emitTwoBytes(OP_CLASS, nameConstant);
+    emitConstantOp(OP_CLASS, OP_CLASS_LONG, nameConstant);
+    defineVariable(current->scopeDepth > 0 ? 0 : identifierGlobal(&className));
 
     ClassCompiler classCompiler;                // added in ch28
     classCompiler.enclosing     = currClass; // added in ch28
@@ -761,7 +1229,7 @@ static void classDeclaration () {
 
 // compiles a function declaration
 static void funDeclaration () {                                                                 // added in ch24
-    uint8_t global = parseVariable("Expect function name.");
+    int global = parseVariable("Expect function name.");
     markInitialized();
     function(TYPE_FUNCTION);
     defineVariable(global);
@@ -769,7 +1237,7 @@ static void funDeclaration () {
 
 // compiles a variable declaration
 static void varDeclaration () {                                                                 // added in ch21
-  uint8_t global = parseVariable("Expect variable name.");
+  int global = parseVariable("Expect variable name.");
 
   if (matchType(TOKEN_EQUAL)) { expression(); }
   else { emitByte(OP_NIL); }
@@ -779,11 +1247,70 @@ static void varDeclaration () {
   defineVariable(global);
 }
 
+#ifdef REGISTER_VM
+// rewrites the statement compiled from start into a single three-address op when it is a plain
+// `local = operand;` or `local = local op operand;` assignment, so nothing goes through the stack
+static bool emitRegisterAssignment (int start) {
+    Chunk*   chunk  = currChunk();
+    uint8_t* code   = chunk->code + start;
+    int      length = chunk->count - start;
+    int      line   = getLine(chunk, start);
+
+    uint8_t op, dst, a, b;
+    current->lastOperator = -1; // the span may get rewritten under it
+    current->constantEnd  = -1;
+    if (length == 4 && code[2] == OP_SET_LOCAL && (code[0] == OP_GET_LOCAL || code[0] == OP_CONSTANT)) {
+        op  = code[0] == OP_GET_LOCAL ? OP_REG_MOVE : OP_REG_LOAD_CONSTANT;
+        dst = code[3];
+        a   = code[1];
+
+        chunk->count = start;
+        writeChunk(chunk, op, line);
+        writeChunk(chunk, dst, line);
+        writeChunk(chunk, a, line);
+        return true;
+    }
+
+    if (length != 7 || code[0] != OP_GET_LOCAL || code[5] != OP_SET_LOCAL) return false;
+    if (code[2] != OP_GET_LOCAL && code[2] != OP_CONSTANT) return false;
+
+    switch (code[4]) {
+        case OP_ADD:      op = OP_REG_ADD;      break;
+        case OP_SUBTRACT: op = OP_REG_SUBTRACT; break;
+        case OP_MULTIPLY: op = OP_REG_MULTIPLY; break;
+        case OP_DIVIDE:   op = OP_REG_DIVIDE;   break;
+        default: return false;
+    }
+
+    if (code[2] == OP_CONSTANT) op += OP_REG_ADD_CONSTANT - OP_REG_ADD;
+    dst = code[6];
+    a   = code[1];
+    b   = code[3];
+
+    chunk->count = start;
+    writeChunk(chunk, op, line);
+    writeChunk(chunk, dst, line);
+    writeChunk(chunk, a, line);
+    writeChunk(chunk, b, line);
+    return true;
+}
+#endif
+
+// discards the value of the expression compiled from start
+static void emitExpressionPop (int start) {
+    #ifdef REGISTER_VM
+    if (!parser.hadError && emitRegisterAssignment(start)) return;
+    #endif
+
+    emitByte(OP_POP);
+}
+
 // compiles an expression statement
 static void expressionStatement () {                                                           // added in ch21
+    int start = currChunk()->count;
     expression();
     consumeToken(TOKEN_SEMICOLON, "Expect ';' after expression.");
-    emitByte(OP_POP);
+    emitExpressionPop(start);
 }
 
 // compiles a for loop
@@ -797,22 +1324,30 @@ static void forStatement () {
 
     int loopStart = currChunk()->count;
     // consume(TOKEN_SEMICOLON, "Expect ';'.");
-    int exitJump = -1;
+    int  exitJump = -1;
+    bool skipped  = false; // the condition is a falsy literal, so the increment and body never run
     if (!matchType(TOKEN_SEMICOLON)) {
+        ChunkMark condition = markChunk();
         expression();
         consumeToken(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
 
         // Jump out of the loop if the condition is false.
-        exitJump = emitJump(OP_JUMP_IF_FALSE);
-        emitByte(OP_POP); // Condition.
+        // exitJump = emitConditionJump();
+        Value value;
+        if (!foldableConstant(condition.count, &value)) { exitJump = emitConditionJump(); }
+        else {
+            rewindChunk(condition);
+            skipped = isFalsey(value);
+        }
     }    
+    ChunkMark body = markChunk();
 
     // consume(TOKEN_CLOSE_PAREN, "Expect ')' after for clauses.");
     if (!matchType(TOKEN_CLOSE_PAREN)) {
         int bodyJump = emitJump(OP_JUMP);
         int incrementStart = currChunk()->count;
         expression();
-        emitByte(OP_POP);
+        emitExpressionPop(incrementStart);
         consumeToken(TOKEN_CLOSE_PAREN, "Expect ')' after for clauses.");
         emitLoop(loopStart);
         loopStart = incrementStart;
@@ -822,30 +1357,68 @@ static void forStatement () {
     statement();
     emitLoop(loopStart);
 
-    if (exitJump != -1) {
-        patchJump(exitJump);
-        emitByte(OP_POP); // Condition.
-    }
+    if (skipped) rewindChunk(body);
+    if (exitJump != -1) patchJump(exitJump);
 
     endScope();
+    current->terminated = exitJump == -1 && !skipped; // nothing but a return leaves a loop with no exit
+}
+
+// compiles a statement that can never run for its errors only, then drops its code
+static void deadStatement () {
+    ChunkMark mark = markChunk();
+    statement();
+    rewindChunk(mark);
+}
+
+// compiles the branches of an if whose condition compiled to a literal: the condition is dropped and
+// only the side it selects is kept
+static void constantIfStatement (ChunkMark condition, bool taken) {
+    rewindChunk(condition);
+
+    if (taken) statement();
+    else       deadStatement();
+    bool terminated = taken && current->terminated;
+
+    if (matchType(TOKEN_ELSE)) {
+        if (taken) { deadStatement(); }
+        else {
+            statement();
+            terminated = current->terminated;
+        }
+    }
+
+    current->terminated = terminated;
 }
 
 // compiles an if statement
 static void ifStatement () {                                                                   // added in ch23
     consumeToken(TOKEN_OPEN_PAREN, "Expect '(' after 'if'.");
+    ChunkMark condition = markChunk();
     expression();
     consumeToken(TOKEN_CLOSE_PAREN, "Expect ')' after condition."); 
 
-    int thenJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);
+    Value value;
+    if (foldableConstant(condition.count, &value)) {
+        constantIfStatement(condition, !isFalsey(value));
+        return;
+    }
+
+    int thenJump = emitConditionJump();
     statement();
+    bool thenTerminated = current->terminated;
+
+    if (!matchType(TOKEN_ELSE)) {
+        patchJump(thenJump);
+        current->terminated = false;
+        return;
+    }
 
     int elseJump = emitJump(OP_JUMP);
     patchJump(thenJump);
-    emitByte(OP_POP);
-
-    if (matchType(TOKEN_ELSE)) { statement(); }
-    patchJump(elseJump); 
+    statement();
+    patchJump(elseJump);
+    current->terminated = current->terminated && thenTerminated;
 }
 
 // compiles a print statement
@@ -864,24 +1437,49 @@ static void returnStatement () {
         if (current->type == TYPE_INITIALIZER) { error("Can't return a value from an initializer."); } // added in ch28
         expression();
         consumeToken(TOKEN_SEMICOLON, "Expect ';' after return value.");
+
+        // `return f(args);` hands its frame to the callee. the OP_RETURN stays behind it for calls that
+        // don't push a frame (natives, classes without init) and for `and` / `or` jumps landing past the call
+        Chunk* chunk = currChunk();
+        if (current->lastCall >= 0 && current->lastCall == chunk->count - 2 && chunk->code[current->lastCall] == OP_CALL) {
+            chunk->code[current->lastCall] = OP_TAIL_CALL;
+        }
         emitByte(OP_RETURN);
     }
+
+    current->terminated = true;
 }
 
 // compiles a while loop
 static void whileStatement () {                                                                // added in ch23
-    int loopStart = currChunk()->count;
+    int       loopStart = currChunk()->count;
+    ChunkMark condition = markChunk();
     consumeToken(TOKEN_OPEN_PAREN, "Expect '(' after 'while'.");
     expression();
     consumeToken(TOKEN_CLOSE_PAREN, "Expect ')' after condition.");
 
-    int exitJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);
+    // a literal condition either never enters the body or never leaves the loop
+    Value value;
+    if (foldableConstant(loopStart, &value)) {
+        rewindChunk(condition);
+        if (isFalsey(value)) {
+            deadStatement();
+            current->terminated = false;
+            return;
+        }
+
+        statement();
+        emitLoop(loopStart);
+        current->terminated = true;
+        return;
+    }
+
+    int exitJump = emitConditionJump();
     statement();
     emitLoop(loopStart);
 
     patchJump(exitJump);
-    emitByte(OP_POP);
+    current->terminated = false;
 }
 
 // tries to synch up the parser after an error
@@ -911,6 +1509,7 @@ static void synchronize () {
 // compiles a declaration
 static void declaration () {                                                                    // added in ch21
 //   statement();
+    current->terminated = false;
     if (matchType(TOKEN_CLASS))    classDeclaration();  // added in ch27
     else if (matchType(TOKEN_FUN)) funDeclaration(); // modified in ch27    
     // if (matchType(TOKEN_FUN))      funDeclaration(); // added in ch24
@@ -922,6 +1521,7 @@ static void declaration () {
 
 //  compiles a statement
 static void statement () {                                                                        // added in ch21
+    current->terminated = false;
     if      (matchType(TOKEN_PRINT))      printStatement();
     else if (matchType(TOKEN_FOR))        forStatement();                                             // added in ch23
     else if (matchType(TOKEN_IF))         ifStatement();                                              // added in ch23
@@ -955,6 +1555,7 @@ ObjFunction* compile (const char* source) {
     while (!matchType(TOKEN_EOF)) { declaration(); } // added in ch21
 
     ObjFunction* function = endCompiler();    // added in ch24
+    FREE_ARRAY(Upvalue, compiler.upvalues, compiler.upvalueCapacity);
     return parser.hadError ? NULL : function; // added in ch24
 
     // expression();
@@ -5,6 +5,7 @@
 #include "debug.hpp"
 #include "object.hpp" // added in ch25
 #include "value.hpp"
+#include "vm.hpp"
 
 // disassemble chunk of code
 void disassembleChunk (Chunk* chunk, const char* name) {
@@ -26,14 +27,24 @@ static int constantInstruction (const char* name, Chunk* chunk, int offset) {
     return offset + 2;
 }
 
-// invokeInstruction is called when the instruction invokes a method
-static int invokeInstruction (const char* name, Chunk* chunk, int offset) { // added in ch28
-    uint8_t constant = chunk->code[offset + 1];
-    uint8_t argCount = chunk->code[offset + 2];
-    printf("%-16s (%d args) %4d '", name, argCount, constant);
+// constantLongInstruction is called when the instruction has a 24-bit constant operand
+static int constantLongInstruction (const char* name, Chunk* chunk, int offset) {
+    int constant = readLongOperand(chunk->code + offset + 1);
+    printf("%-16s %4d '", name, constant);
     printValue(chunk->constants.values[constant]);
     printf("'\n");
-    return offset + 3;
+    return offset + 4;
+}
+
+// invokeInstruction is called when the instruction invokes a method; the method name lives in the cache
+static int invokeInstruction (const char* name, Chunk* chunk, int offset) { // added in ch28
+    // uint8_t constant = chunk->code[offset + 1];
+    uint8_t  argCount = chunk->code[offset + 1];
+    uint16_t cache    = (uint16_t)((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+    printf("%-16s (%d args) %4d '", name, argCount, cache);
+    printValue(OBJ_VAL(chunk->invokeCaches[cache].name));
+    printf("'\n");
+    return offset + 4;
 }
 
 // simpleInstruction is called when the instruction has no arguments
@@ -51,6 +62,13 @@ static int byteInstruction(const char* name, Chunk* chunk, int offset) { // adde
     return offset + 2; 
 }
 
+// shortInstruction is called when the instruction has a two-byte slot or index argument
+static int shortInstruction (const char* name, Chunk* chunk, int offset) {
+    uint16_t slot = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    printf("%-16s %4d\n", name, slot);
+    return offset + 3;
+}
+
 // jumpInstruction is called when the instruction has a jump offset
 static int jumpInstruction(const char* name, int sign, Chunk* chunk, int offset) { // added in ch23
     uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
@@ -60,16 +78,98 @@ static int jumpInstruction(const char* name, int sign, Chunk* chunk, int offset)
     return offset + 3;
 }
 
+// returns the name of a jump instruction, for the kind a LONG_JUMP stands for
+static const char* jumpName (uint8_t instruction) {
+    switch (instruction) {
+        case OP_JUMP:                 return "OP_JUMP";
+        case OP_JUMP_IF_FALSE:        return "OP_JUMP_IF_FALSE";
+        case OP_LOOP:                 return "OP_LOOP";
+        case OP_POP_JUMP_IF_FALSE:    return "OP_POP_JUMP_IF_FALSE";
+        case OP_POP_JUMP_IF_TRUE:     return "OP_POP_JUMP_IF_TRUE";
+        case OP_JUMP_IF_FALSE_OR_POP: return "OP_JUMP_IF_FALSE_OR_POP";
+        case OP_JUMP_IF_TRUE_OR_POP:  return "OP_JUMP_IF_TRUE_OR_POP";
+        case OP_JUMP_IF_NOT_LESS:     return "OP_JUMP_IF_NOT_LESS";
+        case OP_JUMP_IF_LESS:         return "OP_JUMP_IF_LESS";
+        case OP_JUMP_IF_NOT_GREATER:  return "OP_JUMP_IF_NOT_GREATER";
+        case OP_JUMP_IF_GREATER:      return "OP_JUMP_IF_GREATER";
+        case OP_JUMP_IF_NOT_EQUAL:    return "OP_JUMP_IF_NOT_EQUAL";
+        case OP_JUMP_IF_EQUAL:        return "OP_JUMP_IF_EQUAL";
+        default:                      return "?";
+    }
+}
+
+// longJumpInstruction is called for a jump widened to a 24-bit distance
+static int longJumpInstruction (Chunk* chunk, int offset) {
+    uint8_t kind = chunk->code[offset + 1];
+    int     jump = readLongOperand(chunk->code + offset + 2);
+    int     sign = kind == OP_LOOP ? -1 : 1;
+    printf("%-16s %4d -> %d (%s)\n", "OP_LONG_JUMP", offset, offset + 5 + sign * jump, jumpName(kind));
+    return offset + 5;
+}
+
+// globalInstruction is called when the instruction names a slot in the VM's global array
+static int globalInstruction (const char* name, Chunk* chunk, int offset) {
+    uint16_t slot = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    printf("%-16s %4d '", name, slot);
+    printValue(vm.globalNames.values[slot]);
+    printf("'\n");
+    return offset + 3;
+}
+
+// propertyInstruction is called for property instructions, which carry an inline cache index; the cache
+// holds the property name
+static int propertyInstruction (const char* name, Chunk* chunk, int offset) {
+    // uint8_t  constant = chunk->code[offset + 1];
+    uint16_t cache = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    printf("%-16s %4d '", name, cache);
+    printValue(OBJ_VAL(chunk->caches[cache].name));
+    printf("'\n");
+    return offset + 3;
+}
+
+// localConstantInstruction is called when the instruction takes a local slot and a constant
+static int localConstantInstruction (const char* name, Chunk* chunk, int offset) {
+    uint8_t slot     = chunk->code[offset + 1];
+    uint8_t constant = chunk->code[offset + 2];
+    printf("%-16s %4d %4d '", name, slot, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 3;
+}
+
+// registerInstruction is called when the instruction names frame slots directly
+static int registerInstruction (const char* name, int operands, bool constant, Chunk* chunk, int offset) {
+    uint8_t dst = chunk->code[offset + 1];
+    uint8_t a   = chunk->code[offset + 2];
+    printf("%-16s %4d <- ", name, dst);
+
+    if (operands == 1 && !constant) { printf("%d\n", a); return offset + 3; }
+    if (operands == 1) {
+        printf("'");
+        printValue(chunk->constants.values[a]);
+        printf("'\n");
+        return offset + 3;
+    }
+
+    uint8_t b = chunk->code[offset + 3];
+    if (!constant) { printf("%d, %d\n", a, b); return offset + 4; }
+
+    printf("%d, '", a);
+    printValue(chunk->constants.values[b]);
+    printf("'\n");
+    return offset + 4;
+}
+
 // disassembleInstruction is called for each instruction in the chunk
 int disassembleInstruction (Chunk* chunk, int offset) {
     printf("%04d ", offset);
     // std::cout << std::setw(4) << std::setfill('0') << offset << " ";
-    if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+    if (offset > 0 && getLine(chunk, offset) == getLine(chunk, offset - 1)) {
         printf("   | ");
         // std::cout << "   | ";
     } 
     else {
-        printf("%4d ", chunk->lines[offset]);
+        printf("%4d ", getLine(chunk, offset));
         // std::cout << std::setw(4) << std::setfill(' ') << chunk->lines[offset] << " ";
     }
 
@@ -97,13 +197,13 @@ int disassembleInstruction (Chunk* chunk, int offset) {
             return byteInstruction("OP_SET_LOCAL", chunk, offset);
 
         case OP_GET_GLOBAL: // added in ch21
-            return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+            return globalInstruction("OP_GET_GLOBAL", chunk, offset);
 
         case OP_DEFINE_GLOBAL: // added in ch21
-            return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+            return globalInstruction("OP_DEFINE_GLOBAL", chunk, offset);
 
         case OP_SET_GLOBAL: // added in ch21
-            return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+            return globalInstruction("OP_SET_GLOBAL", chunk, offset);
 
         case OP_GET_UPVALUE: // added in ch25
             return byteInstruction("OP_GET_UPVALUE", chunk, offset);
@@ -112,10 +212,10 @@ int disassembleInstruction (Chunk* chunk, int offset) {
             return byteInstruction("OP_SET_UPVALUE", chunk, offset);
 
         case OP_GET_PROPERTY: // added in ch27
-            return constantInstruction("OP_GET_PROPERTY", chunk, offset);
+            return propertyInstruction("OP_GET_PROPERTY", chunk, offset);
 
         case OP_SET_PROPERTY: // added in ch27
-            return constantInstruction("OP_SET_PROPERTY", chunk, offset);
+            return propertyInstruction("OP_SET_PROPERTY", chunk, offset);
 
         case OP_GET_SUPER: // added in ch29
             return constantInstruction("OP_GET_SUPER", chunk, offset);
@@ -168,18 +268,26 @@ int disassembleInstruction (Chunk* chunk, int offset) {
         case OP_SUPER_INVOKE: // added in ch29
             return invokeInstruction("OP_SUPER_INVOKE", chunk, offset);
 
-        case OP_CLOSURE: { // added in ch25
+        case OP_CLOSURE: // added in ch25
+        case OP_CLOSURE_LONG: {
+            bool wide = instruction == OP_CLOSURE_LONG;
             offset++;
-            uint8_t constant = chunk->code[offset++];
-            printf("%-16s %4d ", "OP_CLOSURE", constant);
+            // uint8_t constant = chunk->code[offset++];
+            int constant = wide ? readLongOperand(chunk->code + offset) : chunk->code[offset];
+            offset += wide ? 3 : 1;
+            printf("%-16s %4d ", wide ? "OP_CLOSURE_LONG" : "OP_CLOSURE", constant);
             printValue(chunk->constants.values[constant]);
             printf("\n");
 
             ObjFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
             for (int j = 0; j < function->upvalueCount; j++) {
-                int isLocal = chunk->code[offset++];
+                // int isLocal = chunk->code[offset++];
+                // int index = chunk->code[offset++];
+                int start = offset;
+                int flags = chunk->code[offset++];
                 int index = chunk->code[offset++];
-                printf("%04d      |                     %s %d\n", offset - 2, isLocal ? "local" : "upvalue", index);
+                if (flags & CAPTURE_WIDE) index = (index << 8) | chunk->code[offset++];
+                printf("%04d      |                     %s %d\n", start, flags & CAPTURE_LOCAL ? "local" : "upvalue", index);
             }
             return offset;
         }
@@ -201,6 +309,127 @@ int disassembleInstruction (Chunk* chunk, int offset) {
         case OP_METHOD: // added in ch28
             return constantInstruction("OP_METHOD", chunk, offset);
 
+        case OP_REG_MOVE:
+            return registerInstruction("OP_REG_MOVE", 1, false, chunk, offset);
+
+        case OP_REG_LOAD_CONSTANT:
+            return registerInstruction("OP_REG_LOAD_CONSTANT", 1, true, chunk, offset);
+
+        case OP_REG_ADD:
+            return registerInstruction("OP_REG_ADD", 2, false, chunk, offset);
+
+        case OP_REG_SUBTRACT:
+            return registerInstruction("OP_REG_SUBTRACT", 2, false, chunk, offset);
+
+        case OP_REG_MULTIPLY:
+            return registerInstruction("OP_REG_MULTIPLY", 2, false, chunk, offset);
+
+        case OP_REG_DIVIDE:
+            return registerInstruction("OP_REG_DIVIDE", 2, false, chunk, offset);
+
+        case OP_REG_ADD_CONSTANT:
+            return registerInstruction("OP_REG_ADD_CONSTANT", 2, true, chunk, offset);
+
+        case OP_REG_SUBTRACT_CONSTANT:
+            return registerInstruction("OP_REG_SUBTRACT_CONSTANT", 2, true, chunk, offset);
+
+        case OP_REG_MULTIPLY_CONSTANT:
+            return registerInstruction("OP_REG_MULTIPLY_CONSTANT", 2, true, chunk, offset);
+
+        case OP_REG_DIVIDE_CONSTANT:
+            return registerInstruction("OP_REG_DIVIDE_CONSTANT", 2, true, chunk, offset);
+
+        case OP_ADD_LOCALS:
+            printf("%-16s %4d %4d\n", "OP_ADD_LOCALS", chunk->code[offset + 1], chunk->code[offset + 2]);
+            return offset + 3;
+
+        case OP_ADD_LOCAL_CONSTANT:
+            return localConstantInstruction("OP_ADD_LOCAL_CONSTANT", chunk, offset);
+
+        case OP_SUBTRACT_LOCAL_CONSTANT:
+            return localConstantInstruction("OP_SUBTRACT_LOCAL_CONSTANT", chunk, offset);
+
+        case OP_SET_LOCAL_POP:
+            return byteInstruction("OP_SET_LOCAL_POP", chunk, offset);
+
+        case OP_GET_THIS_PROPERTY:
+            return propertyInstruction("OP_GET_THIS_PROPERTY", chunk, offset);
+
+        case OP_POPN:
+            return byteInstruction("OP_POPN", chunk, offset);
+
+        case OP_POP_JUMP_IF_FALSE:
+            return jumpInstruction("OP_POP_JUMP_IF_FALSE", 1, chunk, offset);
+
+        case OP_POP_JUMP_IF_TRUE:
+            return jumpInstruction("OP_POP_JUMP_IF_TRUE", 1, chunk, offset);
+
+        case OP_JUMP_IF_FALSE_OR_POP:
+            return jumpInstruction("OP_JUMP_IF_FALSE_OR_POP", 1, chunk, offset);
+
+        case OP_JUMP_IF_TRUE_OR_POP:
+            return jumpInstruction("OP_JUMP_IF_TRUE_OR_POP", 1, chunk, offset);
+
+        case OP_JUMP_IF_NOT_LESS:
+            return jumpInstruction("OP_JUMP_IF_NOT_LESS", 1, chunk, offset);
+
+        case OP_JUMP_IF_LESS:
+            return jumpInstruction("OP_JUMP_IF_LESS", 1, chunk, offset);
+
+        case OP_JUMP_IF_NOT_GREATER:
+            return jumpInstruction("OP_JUMP_IF_NOT_GREATER", 1, chunk, offset);
+
+        case OP_JUMP_IF_GREATER:
+            return jumpInstruction("OP_JUMP_IF_GREATER", 1, chunk, offset);
+
+        case OP_JUMP_IF_NOT_EQUAL:
+            return jumpInstruction("OP_JUMP_IF_NOT_EQUAL", 1, chunk, offset);
+
+        case OP_JUMP_IF_EQUAL:
+            return jumpInstruction("OP_JUMP_IF_EQUAL", 1, chunk, offset);
+
+        case OP_ADD_NUMBER:
+            return simpleInstruction("OP_ADD_NUMBER", offset);
+
+        case OP_SUBTRACT_NUMBER:
+            return simpleInstruction("OP_SUBTRACT_NUMBER", offset);
+
+        case OP_LESS_NUMBER:
+            return simpleInstruction("OP_LESS_NUMBER", offset);
+
+        case OP_GREATER_NUMBER:
+            return simpleInstruction("OP_GREATER_NUMBER", offset);
+
+        case OP_TAIL_CALL:
+            return byteInstruction("OP_TAIL_CALL", chunk, offset);
+
+        case OP_CONSTANT_LONG:
+            return constantLongInstruction("OP_CONSTANT_LONG", chunk, offset);
+
+        case OP_GET_LOCAL_LONG:
+            return shortInstruction("OP_GET_LOCAL_LONG", chunk, offset);
+
+        case OP_SET_LOCAL_LONG:
+            return shortInstruction("OP_SET_LOCAL_LONG", chunk, offset);
+
+        case OP_GET_UPVALUE_LONG:
+            return shortInstruction("OP_GET_UPVALUE_LONG", chunk, offset);
+
+        case OP_SET_UPVALUE_LONG:
+            return shortInstruction("OP_SET_UPVALUE_LONG", chunk, offset);
+
+        case OP_CLASS_LONG:
+            return constantLongInstruction("OP_CLASS_LONG", chunk, offset);
+
+        case OP_METHOD_LONG:
+            return constantLongInstruction("OP_METHOD_LONG", chunk, offset);
+
+        case OP_GET_SUPER_LONG:
+            return constantLongInstruction("OP_GET_SUPER_LONG", chunk, offset);
+
+        case OP_LONG_JUMP:
+            return longJumpInstruction(chunk, offset);
+
         default:
             // printf("Unknown opcode %d\n", instruction);
             std::cout << "Unknown opcode " << instruction << std::endl;
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "heap.hpp"
+
+// the part of a page past its header, rounded to the OS page, is what goes back to the OS when the page
+// empties; the header stays put so the page can be chained in the empty pool
+#define HEAP_RELEASE_OFFSET ((sizeof(HeapPage) + 4095) & ~(size_t)4095)
+
+// initialises an empty heap
+void initHeap (Heap* heap) {
+    memset(heap, 0, sizeof(Heap));
+}
+
+// maps a fresh page aligned to HEAP_PAGE_SIZE, by mapping twice that and trimming both ends
+static HeapPage* mapPage () {
+    uint8_t* mapped = (uint8_t*)mmap(NULL, 2 * HEAP_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) exit(1);
+
+    uintptr_t start = ((uintptr_t)mapped + HEAP_PAGE_SIZE - 1) & ~(uintptr_t)(HEAP_PAGE_SIZE - 1);
+    size_t    head  = start - (uintptr_t)mapped;
+    if (head > 0) munmap(mapped, head);
+    munmap((uint8_t*)start + HEAP_PAGE_SIZE, HEAP_PAGE_SIZE - head);
+    return (HeapPage*)start;
+}
+
+// sets up a page, fresh or from the empty pool, for objects of size class sizeClass and puts it at the
+// head of the class's list
+static HeapPage* addPage (Heap* heap, int sizeClass) {
+    HeapPage* page = heap->empty;
+    if (page != NULL) heap->empty = page->next;
+    else page = mapPage();
+
+    page->sizeClass  = sizeClass;
+    page->objectSize = (sizeClass + 1) * HEAP_GRANULE;
+    page->first      = (sizeof(HeapPage) + HEAP_GRANULE - 1) & ~(HEAP_GRANULE - 1);
+    page->slotCount  = (HEAP_PAGE_SIZE - page->first) / page->objectSize;
+    page->bumped     = 0;
+    page->liveCount  = 0;
+    page->freeList   = NULL;
+    page->young      = false;
+    page->unswept    = false;
+    memset(page->marks, 0, sizeof(page->marks));
+    memset(page->live, 0, sizeof(page->live));
+
+    page->next             = heap->pages[sizeClass];
+    heap->pages[sizeClass] = page;
+    return page;
+}
+
+// sweeps one page: every live object left unmarked is released and its slot threaded onto the free list.
+// the marks stay, so the survivors are old from here on. returns how many objects were released
+static int sweepPage (HeapPage* page, void (*release)(Obj* object)) {
+    int freed = 0;
+    for (int word = 0; word < HEAP_BITMAP_WORDS; word++) {
+        uint64_t dead = page->live[word] & ~page->marks[word];
+        page->live[word] &= page->marks[word];
+
+        while (dead != 0) {
+            int   bit  = __builtin_ctzll(dead);
+            void* slot = (uint8_t*)page + ((size_t)word * 64 + bit) * HEAP_GRANULE;
+            release((Obj*)slot);
+
+            *(void**)slot  = page->freeList;
+            page->freeList = slot;
+            dead &= dead - 1;
+            freed++;
+        }
+    }
+
+    page->liveCount -= freed;
+    return freed;
+}
+
+// sweeps a page still holding the marks of a full collection, returning the bytes it freed. a page left
+// empty is reset in place
+static size_t sweepUnswept (HeapPage* page, void (*release)(Obj* object)) {
+    page->unswept = false;
+    size_t freed  = (size_t)sweepPage(page, release) * page->objectSize;
+    if (page->liveCount == 0) {
+        page->bumped   = 0;
+        page->freeList = NULL;
+    }
+    return freed;
+}
+
+// returns a slot for an object of size bytes, setting slotSize to what it takes up in the heap. a page
+// the sweep of a full collection hasn't got to yet is swept on the way, adding the bytes released to freed
+void* heapAllocate (Heap* heap, size_t size, void (*release)(Obj* object), size_t* slotSize, size_t* freed) {
+    if (size > HEAP_OBJECT_MAX) {
+        fprintf(stderr, "Object of %zu bytes is too large for the heap.\n", size);
+        exit(1);
+    }
+
+    int       sizeClass = (int)((size + HEAP_GRANULE - 1) / HEAP_GRANULE) - 1;
+    HeapPage* page      = heap->cursor[sizeClass];
+    uint8_t*  slot      = NULL;
+    while (slot == NULL) {
+        if (page == NULL) page = addPage(heap, sizeClass);
+
+        if (page->unswept) { *freed += sweepUnswept(page, release); }
+        else if (page->freeList != NULL) {
+            slot           = (uint8_t*)page->freeList;
+            page->freeList = *(void**)slot;
+        }
+        else if (page->bumped < page->slotCount) {
+            slot = (uint8_t*)page + page->first + (size_t)page->bumped++ * page->objectSize;
+        }
+        else { page = page->next; }
+    }
+    heap->cursor[sizeClass] = page;
+    if (!page->young) {
+        page->young     = true;
+        page->nextYoung = heap->young;
+        heap->young     = page;
+    }
+
+    size_t granule = granuleOf((Obj*)slot);
+    page->live[granule / 64] |= (uint64_t)1 << (granule % 64);
+    page->liveCount++;
+
+    *slotSize = page->objectSize;
+    return slot;
+}
+
+// empties the young list, leaving every page old
+static void clearYoung (Heap* heap) {
+    for (HeapPage* page = heap->young; page != NULL; page = page->nextYoung) page->young = false;
+    heap->young = NULL;
+}
+
+// starts the sweep of a full collection. every page now holding marks from it is flagged, and the young
+// list is emptied, since the collection looked at everything on it
+void heapStartSweep (Heap* heap) {
+    for (int sizeClass = 0; sizeClass < HEAP_CLASS_COUNT; sizeClass++) {
+        for (HeapPage* page = heap->pages[sizeClass]; page != NULL; page = page->next) page->unswept = true;
+    }
+    clearYoung(heap);
+
+    heap->sweepClass = 0;
+    heap->sweepLink  = &heap->pages[0];
+}
+
+// sweeps the next flagged page, a bitmap word at a time, adding the bytes it freed to freed. returns false
+// once there are none left. a page left empty is handed back to the OS unless it is the last of its class,
+// which is simply reset so a steady churn of short-lived objects doesn't trade the same memory back and
+// forth. pages added since the sweep started hold only new objects, and pages allocation has already
+// swept are done; both are passed over
+bool heapSweepNext (Heap* heap, void (*release)(Obj* object), size_t* freed) {
+    while (heap->sweepClass < HEAP_CLASS_COUNT) {
+        int        sizeClass = heap->sweepClass;
+        HeapPage** link      = heap->sweepLink;
+        HeapPage*  page      = *link;
+        if (page == NULL) {
+            heap->cursor[sizeClass] = heap->pages[sizeClass];
+            if (++heap->sweepClass < HEAP_CLASS_COUNT) heap->sweepLink = &heap->pages[heap->sweepClass];
+            continue;
+        }
+
+        if (!page->unswept) {
+            heap->sweepLink = &page->next;
+            continue;
+        }
+
+        page->unswept = false;
+        *freed += (size_t)sweepPage(page, release) * page->objectSize;
+        if (page->liveCount > 0 || (page == heap->pages[sizeClass] && page->next == NULL)) {
+            if (page->liveCount == 0) {
+                page->bumped   = 0;
+                page->freeList = NULL;
+            }
+            if (page->freeList != NULL || page->bumped < page->slotCount) heap->cursor[sizeClass] = page;
+            heap->sweepLink = &page->next;
+            return true;
+        }
+
+        *link = page->next;
+        if (heap->cursor[sizeClass] == page) heap->cursor[sizeClass] = heap->pages[sizeClass];
+        madvise((uint8_t*)page + HEAP_RELEASE_OFFSET, HEAP_PAGE_SIZE - HEAP_RELEASE_OFFSET, MADV_DONTNEED);
+        page->next  = heap->empty;
+        heap->empty = page;
+        return true;
+    }
+    return false;
+}
+
+// sweeps the page object sits in right away, if the sweep hasn't got to it, and returns the bytes freed.
+// the caller holds object, so the page isn't left empty and stays where it is
+size_t heapSweepPageOf (Obj* object, void (*release)(Obj* object)) {
+    HeapPage* page = pageOf(object);
+    if (!page->unswept) return 0;
+
+    return sweepUnswept(page, release);
+}
+
+// sweeps just the young pages, after a collection that only marked what was allocated since the last one;
+// an unmarked object anywhere else is old and wasn't looked at. a page left empty is reset in place, as
+// unlinking it from its class is left to the full sweep
+size_t heapSweepYoung (Heap* heap, void (*release)(Obj* object)) {
+    size_t freed = 0;
+    for (HeapPage* page = heap->young; page != NULL; page = page->nextYoung) {
+        freed += (size_t)sweepPage(page, release) * page->objectSize;
+        page->young = false;
+
+        if (page->liveCount == 0) {
+            page->bumped   = 0;
+            page->freeList = NULL;
+        }
+    }
+    heap->young = NULL;
+
+    for (int sizeClass = 0; sizeClass < HEAP_CLASS_COUNT; sizeClass++) heap->cursor[sizeClass] = heap->pages[sizeClass];
+    return freed;
+}
+
+// clears the mark of every object, making the whole heap young again for a full collection
+void heapClearMarks (Heap* heap) {
+    for (int sizeClass = 0; sizeClass < HEAP_CLASS_COUNT; sizeClass++) {
+        for (HeapPage* page = heap->pages[sizeClass]; page != NULL; page = page->next) {
+            memset(page->marks, 0, sizeof(page->marks));
+        }
+    }
+}
+
+// unmaps every page of the heap. the objects in them aren't released first: this only happens as the
+// program exits, which takes back whatever they hold outside the heap anyway
+void freeHeap (Heap* heap) {
+    for (int sizeClass = 0; sizeClass < HEAP_CLASS_COUNT; sizeClass++) {
+        HeapPage* page = heap->pages[sizeClass];
+        while (page != NULL) {
+            HeapPage* next = page->next;
+            munmap(page, HEAP_PAGE_SIZE);
+            page = next;
+        }
+    }
+
+    HeapPage* page = heap->empty;
+    while (page != NULL) {
+        HeapPage* next = page->next;
+        munmap(page, HEAP_PAGE_SIZE);
+        page = next;
+    }
+    initHeap(heap);
+}
@@ -0,0 +1,90 @@
+#ifndef clox_heap_hpp
+#define clox_heap_hpp
+
+#include "common.hpp"
+
+typedef struct Obj Obj;
+
+// objects live in pages of HEAP_PAGE_SIZE bytes, each aligned to its own size so the page an object sits
+// in is its address with the low bits cleared. a page holds objects of a single size class, sizes being
+// rounded up to a multiple of HEAP_GRANULE
+#define HEAP_PAGE_SIZE    (64 * 1024)
+#define HEAP_GRANULE      16
+#define HEAP_CLASS_COUNT  16                                   // classes HEAP_GRANULE apart
+#define HEAP_OBJECT_MAX   (HEAP_CLASS_COUNT * HEAP_GRANULE)     // largest object a class can hold
+#define HEAP_BITMAP_WORDS (HEAP_PAGE_SIZE / HEAP_GRANULE / 64)  // one bit per granule of the page
+
+// header at the start of every page. the bitmaps sit beside the objects rather than in them, with a bit
+// for each granule of the page, though only the bit of a slot's first granule is ever set. marks are
+// sticky: an object marked by a collection stays marked, which is what makes it old, until a full
+// collection clears them all
+typedef struct HeapPage {
+    struct HeapPage* next;       // next page of the same size class, or of the empty pool
+    struct HeapPage* nextYoung;  // next page allocated into since the last sweep
+    bool             young;      // on the young list
+    bool             unswept;    // holds the marks of a full collection the sweep hasn't got to yet
+    int              sizeClass;
+    int              objectSize;
+    int              first;      // offset of the first slot
+    int              slotCount;
+    int              bumped;     // slots handed out at least once; the rest have never been touched
+    int              liveCount;
+    void*            freeList;   // slots freed by a sweep, each holding a pointer to the next
+    uint64_t         marks[HEAP_BITMAP_WORDS];
+    uint64_t         live[HEAP_BITMAP_WORDS]; // set for each slot holding an object
+} HeapPage;
+
+// the paged heap. allocation pops the free list of the class's cursor page, or bumps into its untouched
+// slots, moving on down the class's list and adding a page once every one is full. pages still waiting
+// for the sweep of a full collection are swept as allocation comes to them
+typedef struct {
+    HeapPage*  pages[HEAP_CLASS_COUNT];
+    HeapPage*  cursor[HEAP_CLASS_COUNT];
+    HeapPage*  empty;      // pages handed back to the OS, kept mapped for reuse by any class
+    HeapPage*  young;      // pages allocated into since the last sweep; every young object is on one of them
+    int        sweepClass; // where the full sweep is up to: a class, and the link to the next page in it
+    HeapPage** sweepLink;
+} Heap;
+
+// returns the page object sits in
+static inline HeapPage* pageOf (Obj* object) {
+    return (HeapPage*)((uintptr_t)object & ~(uintptr_t)(HEAP_PAGE_SIZE - 1));
+}
+
+// returns the bitmap index of object within its page
+static inline size_t granuleOf (Obj* object) { return ((uintptr_t)object & (HEAP_PAGE_SIZE - 1)) / HEAP_GRANULE; }
+
+static inline bool isMarked (Obj* object) {
+    size_t granule = granuleOf(object);
+    return (pageOf(object)->marks[granule / 64] >> (granule % 64)) & 1;
+}
+
+static inline void setMarked (Obj* object) {
+    size_t granule = granuleOf(object);
+    pageOf(object)->marks[granule / 64] |= (uint64_t)1 << (granule % 64);
+}
+
+// sets the mark of object atomically, for markers running in parallel. returns whether this call set it
+static inline bool trySetMarked (Obj* object) {
+    size_t    granule = granuleOf(object);
+    uint64_t* word    = &pageOf(object)->marks[granule / 64];
+    uint64_t  bit     = (uint64_t)1 << (granule % 64);
+    if (__atomic_load_n(word, __ATOMIC_RELAXED) & bit) return false;
+    return !(__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit);
+}
+
+static inline void clearMarked (Obj* object) {
+    size_t granule = granuleOf(object);
+    pageOf(object)->marks[granule / 64] &= ~((uint64_t)1 << (granule % 64));
+}
+
+void   initHeap        (Heap* heap);
+void*  heapAllocate    (Heap* heap, size_t size, void (*release)(Obj* object), size_t* slotSize, size_t* freed);
+void   heapStartSweep  (Heap* heap);
+bool   heapSweepNext   (Heap* heap, void (*release)(Obj* object), size_t* freed);
+size_t heapSweepPageOf (Obj* object, void (*release)(Obj* object));
+size_t heapSweepYoung  (Heap* heap, void (*release)(Obj* object));
+void   heapClearMarks  (Heap* heap);
+void   freeHeap        (Heap* heap);
+
+#endif
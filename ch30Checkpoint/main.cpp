@@ -1,13 +1,20 @@
 #include <cstdlib> // includes added in ch16
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <string_view> 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "common.hpp"
+#include "bytecode.hpp"
 #include "chunk.hpp"
+#include "compiler.hpp"
 #include "debug.hpp"
 #include "vm.hpp" // added in ch15 
 
@@ -26,6 +33,7 @@ static void repl () { // added in ch16
     }
 }
 
+/*
 // read file, if one is provided
 std::string readFile(std::string_view path) { // added in ch16
     // std::cout << "Attempting to open file: " << path << std::endl;
@@ -52,6 +60,82 @@ std::string readFile(std::string_view path) { // added in ch16
     file.close();
     return buffer;
 }
+*/
+
+// a source file mapped read-only. the scanner stops at a zero byte, so the mapping always runs at least
+// one byte past the text and that byte is zero
+typedef struct {
+    const char* chars;
+    size_t      length;
+    size_t      mapped;
+    bool        regular; // a regular file, which is the only kind worth caching the compiled form of
+} SourceFile;
+
+// reads a source that has no size up front, like a pipe, to its end and copies it into zeroed anonymous
+// memory, so it's laid out and unmapped the same as a mapped file
+static SourceFile readSource (int fd, const char* path) {
+    std::string text;
+    char        buffer[4096];
+    ssize_t     count;
+    while ((count = read(fd, buffer, sizeof(buffer))) > 0) text.append(buffer, (size_t)count);
+    if (count < 0) {
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        exit(74);
+    }
+
+    SourceFile source;
+    source.length = text.size();
+    source.mapped = source.length + 1;
+
+    void* base = mmap(NULL, source.mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+        exit(74);
+    }
+    memcpy(base, text.data(), source.length);
+    source.regular = false;
+
+    close(fd);
+    source.chars = (const char*)base;
+    return source;
+}
+
+// maps the file at path. the whole range is first reserved as zeroed anonymous memory and the file is then
+// mapped over the front of it: the tail of the file's last page reads as zeroes, and when the file ends on
+// a page boundary the byte after it falls in the reserved page, so either way the text is terminated.
+// anything but a regular file has no size to map and is read instead
+static SourceFile mapSource (const char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        exit(74);
+    }
+    if (!S_ISREG(info.st_mode)) return readSource(fd, path);
+
+    SourceFile source;
+    source.length  = (size_t)info.st_size;
+    source.mapped  = source.length + 1;
+    source.regular = true;
+
+    void* base = mmap(NULL, source.mapped, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+        exit(74);
+    }
+    if (source.length > 0 && mmap(base, source.length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        exit(74);
+    }
+
+    madvise(base, source.mapped, MADV_SEQUENTIAL); // the scanner reads it front to back, once
+    close(fd);
+    source.chars = (const char*)base;
+    return source;
+}
+
+// unmaps a source file
+static void unmapSource (SourceFile* source) { munmap((void*)source->chars, source->mapped); }
 
 /*
     static char* readFile(const char* path) {
@@ -84,10 +168,35 @@ std::string readFile(std::string_view path) { // added in ch16
     }
 */
 
-// run file, if one is provided
-static void runFile (std::string_view path) { // added in ch16
-    std::string src = readFile(path);
-    InterpretResult result = interpret(src.data());
+// returns where the compiled form of the script at path is cached: foo.lox -> foo.loxc
+static std::string cachePath (std::string_view path) {
+    std::string cache(path);
+    if (cache.size() >= 4 && cache.compare(cache.size() - 4, 4, ".lox") == 0) return cache + "c";
+    return cache + ".loxc";
+}
+
+// run file, if one is provided. unless useCache is off or the source isn't a regular file, the compiled
+// script is kept next to the source and reused for as long as the source text hashes the same
+// static void runFile (std::string_view path) { // added in ch16
+static void runFile (std::string_view path, bool useCache) {
+    // std::string src = readFile(path);
+    // InterpretResult result = interpret(src.data());
+    SourceFile   source   = mapSource(path.data());
+    useCache = useCache && source.regular;
+    uint64_t     hash     = hashSource(source.chars, source.length);
+    std::string  cache    = cachePath(path);
+    ObjFunction* function = useCache ? loadBytecode(cache.c_str(), hash) : NULL;
+
+    if (function == NULL) {
+        function = compile(source.chars);
+        if (function == NULL) exit(65);
+        if (useCache) saveBytecode(function, hash, cache.c_str()); // best effort: a read-only directory just goes uncached
+    }
+
+    // the compiled script copied what it needs out of the text, so the mapping can go before it runs
+    unmapSource(&source);
+
+    InterpretResult result = interpretFunction(function);
 
     if (result == INTERPRET_COMPILE_ERROR) exit(65);  
     if (result == INTERPRET_RUNTIME_ERROR) exit(70); 
@@ -104,17 +213,49 @@ static void runFile (std::string_view path) { // added in ch16
     }
 */
 
+// prints usage and exits
+static void usage () {
+    fprintf(stderr, "Usage: clox [--max-frames n] [--max-stack n] [--gc-pause microseconds] [--gc-threads n] [--no-cache] [source path]\n");
+    exit(64);
+}
+
+// reads the positive count following a limit flag
+static int limitArgument (int argc, char* argv[], int i) {
+    if (i >= argc) usage();
+    char* end;
+    long value = strtol(argv[i], &end, 10);
+    if (*end != '\0' || value <= 0 || value > INT32_MAX) usage();
+    return (int)value;
+}
+
 int main (int argc, char* argv[]) { // modified in ch16
-    initVM();
+    // initVM();
+    int         framesMax = FRAMES_MAX;
+    int         stackMax  = STACK_MAX;
+    int         gcPause   = GC_MAX_PAUSE;
+    int         gcThreads = GC_MARK_THREADS;
+    const char* path      = NULL;
+    bool        useCache  = true;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--max-frames")      { framesMax = limitArgument(argc, argv, ++i); }
+        else if (arg == "--max-stack")  { stackMax = limitArgument(argc, argv, ++i); }
+        else if (arg == "--gc-pause")   { gcPause = limitArgument(argc, argv, ++i); }
+        else if (arg == "--gc-threads") { gcThreads = limitArgument(argc, argv, ++i); }
+        else if (arg == "--no-cache")   { useCache = false; }
+        else if (path == NULL)          { path = argv[i]; }
+        else                            { usage(); }
+    }
+
+    initVM(framesMax, stackMax, gcPause, gcThreads);
 
     // No path given
-    if (argc == 1) { repl(); }
+    // if (argc == 1) { repl(); }
+    if (path == NULL) { repl(); }
     // Path provided
-    else if (argc == 2)  { runFile(argv[1]); }
-    else {
-        fprintf(stderr, "Usage: clox [source path]\n");
-        exit(64);
-    }
+    // else if (argc == 2)  { runFile(argv[1]); }
+    else { runFile(path, useCache); }
 
     freeVM();
     return 0;
@@ -1,4 +1,8 @@
+#include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "compiler.hpp" // added in ch26
 #include "memory.hpp"
@@ -10,6 +14,29 @@
 #endif
 
 #define GC_HEAP_GROW_FACTOR 2 // added in ch26... this is the factor by which the heap grows when it's full
+#define GC_NURSERY_SIZE (1024 * 1024) // bytes allocated between one minor collection and the next
+#define GC_STEP_SIZE    (256 * 1024)  // bytes allocated between steps of a full collection
+#define GC_CLOCK_INTERVAL 64          // objects traced between looks at the clock
+
+#define GC_SHARE_THRESHOLD 64         // gray objects a marker keeps to itself before offering half to the others
+
+// a marker's gray objects while a trace runs in parallel. the private stack is only touched by the marker
+// that owns it; the shared one is where it leaves work for the others, who steal half of it at a time
+typedef struct {
+    Obj**           items;
+    int             count;
+    int             capacity;
+    pthread_mutex_t lock;
+    Obj**           shared;
+    int             sharedCount;
+    int             sharedCapacity;
+} GrayQueue;
+
+static thread_local GrayQueue* grayQueue = NULL; // the queue of the marker running on this thread, if any
+
+static void pushGray     (Obj* object);
+static void markParallel (Obj* object);
+static void freeObject   (Obj* object);
 
 // reallocates memory
 void* reallocate (void* pointer, size_t oldSize, size_t newSize) {
@@ -20,7 +47,8 @@ void* reallocate (void* pointer, size_t oldSize, size_t newSize) {
         #endif
     }
 
-    if (vm.bytesAllocated > vm.nextGC) { collectGarbage(); } // added in ch26
+    // if (vm.bytesAllocated > vm.nextGC) { collectGarbage(); } // added in ch26
+    if (newSize > oldSize && vm.bytesAllocated > vm.nextGC) { collectGarbage(); } // a sweep frees, and must not collect
 
     if (newSize == 0) {
         free(pointer);
@@ -32,12 +60,42 @@ void* reallocate (void* pointer, size_t oldSize, size_t newSize) {
     return result;
 }
 
+// returns a heap slot for a new object of size bytes, collecting first when that takes the heap past its
+// threshold, the same as reallocate()
+void* allocateSlot (size_t size) {
+    // the slot may be a little bigger than size, but all the heap needs is for the count to be close
+    vm.bytesAllocated += size;
+    #ifdef DEBUG_STRESS_GC
+        collectGarbage();
+    #endif
+
+    if (vm.bytesAllocated > vm.nextGC) { collectGarbage(); }
+
+    size_t slotSize;
+    size_t freed = 0;
+    void*  slot  = heapAllocate(&vm.heap, size, freeObject, &slotSize, &freed);
+    vm.bytesAllocated += slotSize - size;
+    vm.bytesAllocated -= freed;
+
+    // while a full collection is marking, new objects start out gray: they are traced once filled in
+    if (vm.gcPhase == GC_MARK) {
+        setMarked((Obj*)slot);
+        pushGray((Obj*)slot);
+    }
+    return slot;
+}
+
 // mark object for garbage collection
 void markObject (Obj* object) { // added in ch26
-    if (object == NULL)   return;
-    if (object->isMarked) return;
+    if (object == NULL)     return;
+    if (grayQueue != NULL) {
+        markParallel(object);
+        return;
+    }
+    // if (object->isMarked) return;
+    if (isMarked(object))   return;
 
-    vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+    // vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
 
     #ifdef DEBUG_LOG_GC
         printf("%p mark ", (void*)object);
@@ -45,8 +103,13 @@ void markObject (Obj* object) { // added in ch26
         printf("\n");
     #endif
 
-    object->isMarked = true;
+    // object->isMarked = true;
+    setMarked(object);
+    pushGray(object);
+}
 
+// puts a marked object on the gray stack to be traced
+static void pushGray (Obj* object) {
     if (vm.grayCapacity < vm.grayCount + 1) {
         vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
         vm.grayStack = (Obj**)realloc(vm.grayStack, sizeof(Obj*) * vm.grayCapacity);
@@ -58,6 +121,87 @@ void markObject (Obj* object) { // added in ch26
 
 void markValue (Value value) { if (IS_OBJ(value)) markObject(AS_OBJ(value)); } // added in ch26... this is the function that marks values
 
+// appends item to a collector list
+static void pushGCList (GCList* list, void* item) {
+    if (list->capacity < list->count + 1) {
+        list->capacity = GROW_CAPACITY(list->capacity);
+        list->items = (void**)realloc(list->items, sizeof(void*) * list->capacity);
+        if (list->items == NULL) exit(1);
+    }
+
+    list->items[list->count++] = item;
+}
+
+// takes item off a collector list, if it's there
+static void removeGCList (GCList* list, void* item) {
+    for (int i = 0; i < list->count; i++) {
+        if (list->items[i] == item) {
+            list->items[i] = list->items[--list->count];
+            return;
+        }
+    }
+}
+
+// the slow path of the write barrier, for an owner already marked given an object that isn't. while a full
+// collection is marking, the owner may have been traced already, so the object is marked, leaving it for
+// the collection to trace (Dijkstra's barrier). otherwise the owner is old and goes on the remembered set.
+// it loses its mark, which keeps the barrier from adding it twice and has the next minor collection mark
+// and trace it like a young object; if it's waiting on the sweep, its page is swept first
+void writeBarrierSlow (Obj* owner, Obj* object) {
+    if (vm.gcPhase == GC_MARK) {
+        markObject(object);
+        return;
+    }
+
+    if (vm.gcPhase == GC_SWEEP) vm.bytesAllocated -= heapSweepPageOf(owner, freeObject);
+    clearMarked(owner);
+    pushGCList(&vm.rememberedObjects, owner);
+}
+
+// the write barrier of a table, whose owner isn't known, so the table itself goes on the remembered set.
+// while marking, key and value are marked instead. the VM's own tables stay out of it: the globals are
+// marked as roots every time, and the string table is weak
+void writeBarrierTable (Table* table, ObjString* key, Value value) {
+    if (table == &vm.strings) return;
+
+    if (vm.gcPhase == GC_MARK) {
+        markObject((Obj*)key);
+        markValue(value);
+        return;
+    }
+
+    if (table == &vm.globalSlots) return;
+    table->remembered = true;
+    pushGCList(&vm.rememberedTables, table);
+}
+
+// the same for an array, leaving out the global arrays as they are roots
+void writeBarrierArray (ValueArray* array, Value value) {
+    if (vm.gcPhase == GC_MARK) {
+        markValue(value);
+        return;
+    }
+
+    if (array == &vm.globalNames || array == &vm.globalValues) return;
+    array->remembered = true;
+    pushGCList(&vm.rememberedArrays, array);
+}
+
+// takes a table that's being freed off the remembered set
+void forgetTable (Table* table) {
+    removeGCList(&vm.rememberedTables, table);
+    table->remembered = false;
+}
+
+// takes an array that's being freed off the remembered set
+void forgetArray (ValueArray* array) {
+    removeGCList(&vm.rememberedArrays, array);
+    array->remembered = false;
+}
+
+// notes a newly interned string, so a minor collection can drop it from the string table if it dies young
+void rememberString (ObjString* string) { pushGCList(&vm.youngStrings, string); }
+
 // mark array for garbage collection
 static void markArray(ValueArray* array) { // added in ch26
     for (int i = 0; i < array->count; i++) { markValue(array->values[i]); }
@@ -83,6 +227,7 @@ static void blackenObject (Obj* object) { // added in ch26
             ObjClass* klass = (ObjClass*)object;
             markObject((Obj*)klass->name);
             markTable(&klass->methods); // added in ch28
+            markObject((Obj*)klass->shape);
             break;
         }
 
@@ -97,13 +242,38 @@ static void blackenObject (Obj* object) { // added in ch26
             ObjFunction* function = (ObjFunction*)object;
             markObject((Obj*)function->name);
             markArray(&function->chunk.constants);
+            for (int i = 0; i < function->chunk.cacheCount; i++) {
+                PropertyCache* cache = &function->chunk.caches[i];
+                markObject((Obj*)cache->name);
+                markObject((Obj*)cache->shape);
+                markObject((Obj*)cache->transition);
+                markValue(cache->method);
+            }
+            for (int i = 0; i < function->chunk.invokeCacheCount; i++) {
+                InvokeCache* cache = &function->chunk.invokeCaches[i];
+                markObject((Obj*)cache->name);
+                for (int j = 0; j < cache->count; j++) {
+                    markObject(cache->keys[j]);
+                    markValue(cache->methods[j]);
+                }
+            }
             break;
         }
 
         case OBJ_INSTANCE: { // added in ch27
             ObjInstance* instance = (ObjInstance*)object;
             markObject((Obj*)instance->klass);
-            markTable(&instance->fields);
+            markObject((Obj*)instance->shape);
+            for (int i = 0; i < instance->shape->fieldCount; i++) { markValue(instance->fields[i]); }
+            break;
+        }
+
+        case OBJ_SHAPE: {
+            ObjShape* shape = (ObjShape*)object;
+            markObject((Obj*)shape->parent);
+            markObject((Obj*)shape->name);
+            markTable(&shape->transitions);
+            markTable(&shape->slots);
             break;
         }
 
@@ -117,7 +287,7 @@ static void blackenObject (Obj* object) { // added in ch26
     }
 }
 
-// free object from memory
+// frees what an object owns outside the heap; the sweep that found it dead takes back its slot
 static void freeObject (Obj* object) { // added in ch19
     #ifdef DEBUG_LOG_GC // added in ch26
         printf("%p free type %d\n", (void*)object, object->type);
@@ -125,50 +295,59 @@ static void freeObject (Obj* object) { // added in ch19
 
     switch (object->type) {
         case OBJ_BOUND_METHOD: // added in ch28
-            FREE(ObjBoundMethod, object);
+            // FREE(ObjBoundMethod, object);
             break;
 
         case OBJ_CLASS: { // added in ch27
             ObjClass* klass = (ObjClass*)object; // added in ch28
             freeTable(&klass->methods); // added in ch28
-            FREE(ObjClass, object);
+            // FREE(ObjClass, object);
             break;
         } 
 
         case OBJ_CLOSURE: { // added in ch25
             ObjClosure* closure = (ObjClosure*)object;
             FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
-            FREE(ObjClosure, object);
+            // FREE(ObjClosure, object);
             break;
         }
 
         case OBJ_FUNCTION: { // added in ch24
             ObjFunction* function = (ObjFunction*)object;
             freeChunk(&function->chunk);
-            FREE(ObjFunction, object);
+            // FREE(ObjFunction, object);
             break;
         }
 
         case OBJ_INSTANCE: { // added in ch27
             ObjInstance* instance = (ObjInstance*)object;
-            freeTable(&instance->fields);
-            FREE(ObjInstance, object);
+            FREE_ARRAY(Value, instance->fields, instance->fieldCapacity);
+            // FREE(ObjInstance, object);
+            break;
+        }
+
+        case OBJ_SHAPE: {
+            ObjShape* shape = (ObjShape*)object;
+            freeTable(&shape->transitions);
+            freeTable(&shape->slots);
+            // FREE(ObjShape, object);
             break;
         }
 
         case OBJ_NATIVE: // added in ch24
-            FREE(ObjNative, object);
+            // FREE(ObjNative, object);
             break;
 
         case OBJ_STRING: {
             ObjString* string = (ObjString*)object;
-            FREE_ARRAY(char, string->chars, string->length + 1);
-            FREE(ObjString, object);
+            // FREE_ARRAY(char, string->chars, string->length + 1);
+            if (!string->literal) FREE_ARRAY(char, string->chars, string->length + 1); // arena characters go with the VM
+            // FREE(ObjString, object);
             break;
         }
 
         case OBJ_UPVALUE: // added in ch25
-            FREE(ObjUpvalue, object);
+            // FREE(ObjUpvalue, object);
             break;
     }
 }
@@ -181,13 +360,238 @@ static void markRoots () { // added in ch26
 
     for (ObjUpvalue* upvalue = vm.openUpvalues; upvalue != NULL; upvalue = upvalue->next) { markObject((Obj*)upvalue); }
 
-    markTable(&vm.globals);
+    markTable(&vm.globalSlots);
+    markArray(&vm.globalNames);
+    markArray(&vm.globalValues);
     markCompilerRoots();
     markObject((Obj*)vm.initString); // added in ch28
 }
 
+// returns the monotonic clock in nanoseconds
+static uint64_t clockNanos () {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+// the threads that trace alongside the main thread when vm.markThreads is more than one. they're started
+// the first time they're needed and wait between rounds, a round being one parallel trace of the gray stack
+typedef struct {
+    pthread_t       threads[GC_MARKERS_MAX];
+    GrayQueue       queues[GC_MARKERS_MAX]; // one per marker; the main thread has the first
+    int             count;                  // markers, the main thread included; 0 until they're started
+    pthread_mutex_t lock;
+    pthread_cond_t  start;
+    pthread_cond_t  done;
+    uint64_t        round;                  // bumped to start a round
+    int             finished;               // threads done with the round
+    int             idle;                   // markers out of work and looking for more
+    bool            stop;                   // the round has run past its deadline
+    bool            quit;
+    uint64_t        deadline;
+} MarkerPool;
+
+static MarkerPool markers;
+
+// grows a gray array to hold at least count objects
+static Obj** growGray (Obj** items, int* capacity, int count) {
+    if (*capacity >= count) return items;
+    while (*capacity < count) *capacity = GROW_CAPACITY(*capacity);
+
+    items = (Obj**)realloc(items, sizeof(Obj*) * *capacity);
+    if (items == NULL) exit(1);
+    return items;
+}
+
+// marks an object for the marker running on this thread. the bit is set atomically, so when two markers
+// reach the same object only one of them traces it
+static void markParallel (Obj* object) {
+    if (!trySetMarked(object)) return;
+
+    GrayQueue* queue = grayQueue;
+    queue->items = growGray(queue->items, &queue->capacity, queue->count + 1);
+    queue->items[queue->count++] = object;
+}
+
+// moves the older half of a marker's private stack to its shared one, for the others to steal
+static void shareGray (GrayQueue* queue) {
+    int half = queue->count / 2;
+    pthread_mutex_lock(&queue->lock);
+    queue->shared = growGray(queue->shared, &queue->sharedCapacity, queue->sharedCount + half);
+    memcpy(queue->shared + queue->sharedCount, queue->items, sizeof(Obj*) * half);
+    __atomic_store_n(&queue->sharedCount, queue->sharedCount + half, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&queue->lock);
+
+    memmove(queue->items, queue->items + half, sizeof(Obj*) * (queue->count - half));
+    queue->count -= half;
+}
+
+// moves half of victim's shared objects to thief's private stack, or all of them when a marker takes back
+// its own. returns whether there were any
+static bool stealGray (GrayQueue* thief, GrayQueue* victim) {
+    if (__atomic_load_n(&victim->sharedCount, __ATOMIC_RELAXED) == 0) return false;
+
+    pthread_mutex_lock(&victim->lock);
+    int taken = victim == thief ? victim->sharedCount : (victim->sharedCount + 1) / 2;
+    int left  = victim->sharedCount - taken;
+    if (taken > 0) { // another thief may have got there first
+        thief->items = growGray(thief->items, &thief->capacity, thief->count + taken);
+        memcpy(thief->items + thief->count, victim->shared + left, sizeof(Obj*) * taken);
+        thief->count += taken;
+        __atomic_store_n(&victim->sharedCount, left, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&victim->lock);
+    return taken > 0;
+}
+
+// returns a marker's next gray object: off its private stack, then its shared one, then stolen from the
+// others. NULL when none of them has any
+static Obj* takeGray (GrayQueue* queue) {
+    if (queue->count > 0) return queue->items[--queue->count];
+
+    int self = (int)(queue - markers.queues);
+    for (int i = 0; i < markers.count; i++) {
+        if (stealGray(queue, &markers.queues[(self + i) % markers.count])) return queue->items[--queue->count];
+    }
+    return NULL;
+}
+
+// one marker's part in a round: traces until every marker is out of work or the deadline passes. a marker
+// only goes idle with both its stacks empty and an idle marker makes no more work, so once all of them are
+// idle there's none left anywhere
+static void traceMarker (GrayQueue* queue) {
+    int traced = 0;
+    while (!__atomic_load_n(&markers.stop, __ATOMIC_RELAXED)) {
+        Obj* object = takeGray(queue);
+        if (object != NULL) {
+            blackenObject(object);
+            if (queue->count > GC_SHARE_THRESHOLD && __atomic_load_n(&queue->sharedCount, __ATOMIC_RELAXED) == 0) shareGray(queue);
+            if (++traced % GC_CLOCK_INTERVAL == 0 && clockNanos() >= markers.deadline) __atomic_store_n(&markers.stop, true, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        __atomic_add_fetch(&markers.idle, 1, __ATOMIC_SEQ_CST);
+        while (true) {
+            if (__atomic_load_n(&markers.idle, __ATOMIC_SEQ_CST) == markers.count) return;
+            if (__atomic_load_n(&markers.stop, __ATOMIC_RELAXED)) return;
+
+            bool found = false;
+            for (int i = 0; i < markers.count && !found; i++) found = __atomic_load_n(&markers.queues[i].sharedCount, __ATOMIC_RELAXED) > 0;
+            if (found) break;
+            sched_yield();
+        }
+        __atomic_sub_fetch(&markers.idle, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+// the body of a marker thread: waits for a round, takes its part, and reports back
+static void* markerThread (void* argument) {
+    GrayQueue* queue = (GrayQueue*)argument;
+    uint64_t   seen  = 0;
+    grayQueue = queue;
+
+    while (true) {
+        pthread_mutex_lock(&markers.lock);
+        while (markers.round == seen && !markers.quit) pthread_cond_wait(&markers.start, &markers.lock);
+        seen      = markers.round;
+        bool quit = markers.quit;
+        pthread_mutex_unlock(&markers.lock);
+        if (quit) return NULL;
+
+        traceMarker(queue);
+
+        pthread_mutex_lock(&markers.lock);
+        if (++markers.finished == markers.count - 1) pthread_cond_signal(&markers.done);
+        pthread_mutex_unlock(&markers.lock);
+    }
+}
+
+// starts the marker threads
+static void startMarkers () {
+    markers.count = vm.markThreads < GC_MARKERS_MAX ? vm.markThreads : GC_MARKERS_MAX;
+    pthread_mutex_init(&markers.lock, NULL);
+    pthread_cond_init(&markers.start, NULL);
+    pthread_cond_init(&markers.done, NULL);
+
+    for (int i = 0; i < markers.count; i++) pthread_mutex_init(&markers.queues[i].lock, NULL);
+    for (int i = 1; i < markers.count; i++) {
+        if (pthread_create(&markers.threads[i], NULL, markerThread, &markers.queues[i]) != 0) exit(1);
+    }
+}
+
+// stops the marker threads, if they were started, and frees their queues
+static void stopMarkers () {
+    if (markers.count == 0) return;
+
+    pthread_mutex_lock(&markers.lock);
+    markers.quit = true;
+    pthread_cond_broadcast(&markers.start);
+    pthread_mutex_unlock(&markers.lock);
+
+    for (int i = 1; i < markers.count; i++) pthread_join(markers.threads[i], NULL);
+    for (int i = 0; i < markers.count; i++) {
+        free(markers.queues[i].items);
+        free(markers.queues[i].shared);
+        pthread_mutex_destroy(&markers.queues[i].lock);
+    }
+    pthread_cond_destroy(&markers.done);
+    pthread_cond_destroy(&markers.start);
+    pthread_mutex_destroy(&markers.lock);
+    memset(&markers, 0, sizeof(markers));
+}
+
+// traces the gray stack with every marker until it's all traced or deadline passes, handing it to the
+// main thread's marker for the others to steal from. whatever's left goes back on the gray stack. returns
+// whether everything was traced
+static bool traceParallel (uint64_t deadline) {
+    if (vm.grayCount == 0)  return true;
+    if (markers.count == 0) startMarkers();
+
+    GrayQueue* first = &markers.queues[0];
+    first->shared = growGray(first->shared, &first->sharedCapacity, vm.grayCount);
+    memcpy(first->shared, vm.grayStack, sizeof(Obj*) * vm.grayCount);
+    first->sharedCount = vm.grayCount;
+    vm.grayCount       = 0;
+
+    pthread_mutex_lock(&markers.lock);
+    markers.deadline = deadline;
+    markers.stop     = false;
+    markers.idle     = 0;
+    markers.finished = 0;
+    markers.round++;
+    pthread_cond_broadcast(&markers.start);
+    pthread_mutex_unlock(&markers.lock);
+
+    grayQueue = first;
+    traceMarker(first);
+    grayQueue = NULL;
+
+    pthread_mutex_lock(&markers.lock);
+    while (markers.finished < markers.count - 1) pthread_cond_wait(&markers.done, &markers.lock);
+    pthread_mutex_unlock(&markers.lock);
+
+    for (int i = 0; i < markers.count; i++) {
+        GrayQueue* queue = &markers.queues[i];
+        if (queue->count + queue->sharedCount == 0) continue;
+
+        vm.grayStack = growGray(vm.grayStack, &vm.grayCapacity, vm.grayCount + queue->count + queue->sharedCount);
+        if (queue->count > 0) memcpy(vm.grayStack + vm.grayCount, queue->items, sizeof(Obj*) * queue->count);
+        vm.grayCount += queue->count;
+        if (queue->sharedCount > 0) memcpy(vm.grayStack + vm.grayCount, queue->shared, sizeof(Obj*) * queue->sharedCount);
+        vm.grayCount += queue->sharedCount;
+        queue->count       = 0;
+        queue->sharedCount = 0;
+    }
+    return vm.grayCount == 0;
+}
+
 // trace references is called when the garbage collector is called
 static void traceReferences () { // added in ch26
+    if (vm.markThreads > 1) {
+        traceParallel(UINT64_MAX);
+        return;
+    }
+
     while (vm.grayCount > 0) {
         Obj* object = vm.grayStack[--vm.grayCount];
         blackenObject(object);
@@ -195,37 +599,143 @@ static void traceReferences () { // added in ch26
 }
 
 // sweep is called when the garbage collector is called
-static void sweep() { // added in ch26
-    Obj* previous = NULL;
-    Obj* object = vm.objects;
-    while (object != NULL) {
-        if (object->isMarked) {
-            object->isMarked = false;
-            previous = object;
-            object = object->next;
-        } 
-        else {
-            Obj* unreached = object;
-            object = object->next;
-                if (previous != NULL) { previous->next = object; }
-                else { vm.objects = object; } 
+// static void sweep() { // added in ch26
+//     Obj* previous = NULL;
+//     Obj* object = vm.objects;
+//     while (object != NULL) {
+//         if (object->isMarked) {
+//             object->isMarked = false;
+//             previous = object;
+//             object = object->next;
+//         } 
+//         else {
+//             Obj* unreached = object;
+//             object = object->next;
+//                 if (previous != NULL) { previous->next = object; }
+//                 else { vm.objects = object; } 
+//
+//                 freeObject(unreached);
+//         }
+//     }
+// }
+
+// empties the remembered set and the young strings once a collection is done with them
+static void clearRemembered () {
+    for (int i = 0; i < vm.rememberedTables.count; i++) { ((Table*)vm.rememberedTables.items[i])->remembered = false; }
+    for (int i = 0; i < vm.rememberedArrays.count; i++) { ((ValueArray*)vm.rememberedArrays.items[i])->remembered = false; }
+
+    vm.rememberedObjects.count = 0;
+    vm.rememberedTables.count  = 0;
+    vm.rememberedArrays.count  = 0;
+    vm.youngStrings.count      = 0;
+}
+
+// minor collection: everything still marked is old and taken to be alive, so marking starts from the roots
+// and the remembered set and stops at old objects, and only the pages allocated into since are swept.
+// what survives keeps its mark and is old from then on
+static void collectYoung () {
+    markRoots();
+    for (int i = 0; i < vm.rememberedObjects.count; i++) { markObject((Obj*)vm.rememberedObjects.items[i]); }
+    for (int i = 0; i < vm.rememberedTables.count; i++) { markTable((Table*)vm.rememberedTables.items[i]); }
+    for (int i = 0; i < vm.rememberedArrays.count; i++) { markArray((ValueArray*)vm.rememberedArrays.items[i]); }
+    traceReferences();
 
-                freeObject(unreached);
+    for (int i = 0; i < vm.youngStrings.count; i++) {
+        ObjString* string = (ObjString*)vm.youngStrings.items[i];
+        if (!isMarked((Obj*)string)) tableDelete(&vm.strings, string);
+    }
+
+    clearRemembered();
+    vm.bytesAllocated -= heapSweepYoung(&vm.heap, freeObject);
+}
+
+// starts a full collection by clearing every mark and marking the roots. the tracing and the sweep are
+// left to steps taken as the program goes on allocating
+static void startFullGC () {
+    clearRemembered();
+    heapClearMarks(&vm.heap);
+    markRoots();
+
+    vm.gcPhase    = GC_MARK;
+    vm.nextFullGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR; // where the collection means to be done by
+}
+
+// ends the marking of a full collection. the stack and the globals are written without the barrier, so the
+// roots are marked again and whatever that finds traced; everything still unmarked after that is garbage
+static void finishMarking () {
+    markRoots();
+    traceReferences();
+    tableRemoveWhite(&vm.strings);
+    vm.youngStrings.count = 0;
+
+    heapStartSweep(&vm.heap);
+    vm.gcPhase = GC_SWEEP;
+}
+
+// takes a step of the full collection under way: traces gray objects and then sweeps pages until the step
+// has run for vm.gcMaxPause or the collection is done. the clock is read every GC_CLOCK_INTERVAL objects or
+// after each page. allocation sweeps the pages it comes to itself, so the steps are left with the rest
+static void stepFullGC () {
+    uint64_t deadline = clockNanos() + vm.gcMaxPause;
+    int      work     = 0;
+
+    while (vm.gcPhase != GC_IDLE) {
+        if (vm.gcPhase == GC_MARK && vm.markThreads > 1 && vm.grayCount > 0) {
+            if (!traceParallel(deadline)) return;
+        }
+        else if (vm.gcPhase == GC_MARK) {
+            if (vm.grayCount > 0) blackenObject(vm.grayStack[--vm.grayCount]);
+            else finishMarking();
+            work++;
+        }
+        else {
+            size_t freed = 0;
+            bool   more  = heapSweepNext(&vm.heap, freeObject, &freed);
+            vm.bytesAllocated -= freed;
+            work = GC_CLOCK_INTERVAL;
+
+            if (!more) {
+                vm.gcPhase    = GC_IDLE;
+                vm.nextFullGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+            }
         }
+
+        if (work < GC_CLOCK_INTERVAL) continue;
+        work = 0;
+        if (clockNanos() >= deadline) return;
     }
 }
 
-// garbage collector
+// returns the bytes to allocate before the next step of a full collection. they shrink as the heap nears
+// nextFullGC, down to a step every allocation past it, so a collection falling behind the program takes
+// its steps more often rather than making any of them longer
+static size_t stepInterval () {
+    size_t headroom = vm.bytesAllocated < vm.nextFullGC ? vm.nextFullGC - vm.bytesAllocated : 0;
+    return headroom / 16 < GC_STEP_SIZE ? headroom / 16 : GC_STEP_SIZE;
+}
+
+// garbage collector. a minor collection runs every GC_NURSERY_SIZE bytes until what survives has grown past
+// nextFullGC. that starts a full collection, which then takes a step every GC_STEP_SIZE bytes or less
+// instead, so no single pause is much longer than vm.gcMaxPause
 void collectGarbage () { // added in ch26
     #ifdef DEBUG_LOG_GC
-        printf("-- gc begin\n");
+        printf("-- gc begin (%s)\n", vm.gcPhase == GC_IDLE ? "minor" : vm.gcPhase == GC_MARK ? "mark" : "sweep");
         size_t before = vm.bytesAllocated;
     #endif
 
-    markRoots();
-    traceReferences();
-    tableRemoveWhite(&vm.strings);
-    sweep();
+    // markRoots();
+    // traceReferences();
+    // tableRemoveWhite(&vm.strings);
+    // sweep();
+    if (vm.gcPhase == GC_IDLE) {
+        collectYoung();
+        if (vm.bytesAllocated > vm.nextFullGC) startFullGC();
+    }
+
+    // a full collection just started takes its first step right away, which may be all a small heap needs
+    if (vm.gcPhase != GC_IDLE) stepFullGC();
+
+    vm.nextGC = vm.bytesAllocated + (vm.gcPhase == GC_IDLE ? GC_NURSERY_SIZE : stepInterval());
 
     #ifdef DEBUG_LOG_GC
         printf("-- gc end\n");
@@ -235,12 +745,19 @@ void collectGarbage () { // added in ch26
 
 // free objects from memory
 void freeObjects () { // added in ch19
-    Obj* object = vm.objects;
-    while (object != NULL) {
-        Obj* next = object->next;
-        freeObject(object);
-        object = next;
-    }
+    // Obj* object = vm.objects;
+    // while (object != NULL) {
+    //     Obj* next = object->next;
+    //     freeObject(object);
+    //     object = next;
+    // }
+    clearRemembered();
+    stopMarkers();
+    freeHeap(&vm.heap);
 
     free(vm.grayStack); // added in ch26
+    free(vm.rememberedObjects.items);
+    free(vm.rememberedTables.items);
+    free(vm.rememberedArrays.items);
+    free(vm.youngStrings.items);
 }
\ No newline at end of file
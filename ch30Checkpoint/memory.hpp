@@ -2,6 +2,7 @@
 #define clox_memory_hpp
 
 #include "common.hpp"
+#include "heap.hpp"
 #include "object.hpp" // added in ch19
 
 #define ALLOCATE(type, count) (type*)reallocate(NULL, 0, sizeof(type) * (count)) // added in ch19... this is the function that allocates memory
@@ -15,9 +16,27 @@
 #define FREE_ARRAY(type, pointer, oldCount) reallocate(pointer, sizeof(type) * (oldCount), 0) // frees the array
 
 void* reallocate (void* pointer, size_t oldSize, size_t newSize);
+void* allocateSlot (size_t size);
 void  markValue(Value value);  // added in ch26
 void  markObject(Obj* object); // added in ch26
 void  collectGarbage();        // added in ch26
 void  freeObjects();           // added in ch19
+void  writeBarrierSlow(Obj* owner, Obj* object);
+void  writeBarrierTable(Table* table, ObjString* key, Value value);
+void  writeBarrierArray(ValueArray* array, Value value);
+void  forgetTable(Table* table);
+void  forgetArray(ValueArray* array);
+void  rememberString(ObjString* string);
+
+// the write barrier, run after a reference to object is stored in owner. an old owner pointing at a young
+// object goes on the remembered set, since the next minor collection only traces from there and the roots,
+// and an owner a full collection has traced pointing at an object it hasn't marked has the object marked
+static inline void writeBarrier (Obj* owner, Obj* object) {
+    if (object != NULL && isMarked(owner) && !isMarked(object)) writeBarrierSlow(owner, object);
+}
+
+static inline void writeBarrierValue (Obj* owner, Value value) {
+    if (IS_OBJ(value)) writeBarrier(owner, AS_OBJ(value));
+}
 
 #endif
\ No newline at end of file
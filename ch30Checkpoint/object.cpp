@@ -1,5 +1,6 @@
 #include <iostream>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "memory.hpp"
@@ -10,13 +11,16 @@
 
 #define ALLOCATE_OBJ(type, objectType) (type*)allocateObject(sizeof(type), objectType) // allocates memory for an object
 
+#define LITERAL_BLOCK_SIZE (64 * 1024)
+
 // creates and allocates memory for an object
 static Obj* allocateObject (size_t size, ObjType type) {
-    Obj* object = (Obj*)reallocate(NULL, 0, size);
+    // Obj* object = (Obj*)reallocate(NULL, 0, size);
+    Obj* object = (Obj*)allocateSlot(size);
     object->type = type;
-    object->isMarked = false; // added in ch26
-    object->next = vm.objects;
-    vm.objects = object;
+    // object->isMarked = false; // added in ch26
+    // object->next = vm.objects;
+    // vm.objects = object;
 
     #ifdef DEBUG_LOG_GC     // added in ch26
         printf("%p allocate %zu for %d\n", (void*)object, size, type);
@@ -37,7 +41,14 @@ ObjBoundMethod* newBoundMethod (Value receiver, ObjClosure* method) { // added i
 ObjClass* newClass (ObjString* name) { // added in ch27
     ObjClass* klass = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
     klass->name = name; 
+    klass->shape = NULL;
+    klass->instanceFields = 0;
     initTable(&klass->methods); // added in ch28
+
+    push(OBJ_VAL(klass));
+    klass->shape = newShape(NULL, NULL);
+    writeBarrier((Obj*)klass, (Obj*)klass->shape);
+    pop();
     return klass;
 }
 
@@ -58,6 +69,7 @@ ObjFunction* newFunction () { // added in ch24
     ObjFunction* function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
     function->upvalueCount = 0; // added in ch25
+    function->maxSlots = 0;
     function->name = NULL;
     initChunk(&function->chunk);
     return function;
@@ -65,9 +77,13 @@ ObjFunction* newFunction () { // added in ch24
 
 // instantiates a new instance
 ObjInstance* newInstance (ObjClass* klass) { // added in ch27
+    Value* fields = ALLOCATE(Value, klass->instanceFields);
+
     ObjInstance* instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
     instance->klass = klass;
-    initTable(&instance->fields);
+    instance->shape = klass->shape;
+    instance->fields = fields;
+    instance->fieldCapacity = klass->instanceFields;
     return instance;
 }
 
@@ -78,16 +94,85 @@ ObjNative* newNative (NativeFn function) { // added in ch24
     return native;
 }
 
+// instantiates a new shape with one more field than parent, or an empty root shape
+ObjShape* newShape (ObjShape* parent, ObjString* name) {
+    ObjShape* shape = ALLOCATE_OBJ(ObjShape, OBJ_SHAPE);
+    shape->parent = parent;
+    shape->name = name;
+    shape->fieldCount = 0;
+    initTable(&shape->transitions);
+    initTable(&shape->slots);
+    if (parent == NULL) return shape;
+
+    push(OBJ_VAL(shape));
+    tableAddAll(&parent->slots, &shape->slots);
+    tableSet(&shape->slots, name, NUMBER_VAL((double)parent->fieldCount));
+    shape->fieldCount = parent->fieldCount + 1;
+    tableSet(&parent->transitions, name, OBJ_VAL(shape));
+    pop();
+    return shape;
+}
+
+// returns the shape reached by adding name to shape, creating the transition the first time it's taken
+ObjShape* shapeAddField (ObjShape* shape, ObjString* name) {
+    Value child;
+    if (tableGet(&shape->transitions, name, &child)) return AS_SHAPE(child);
+    return newShape(shape, name);
+}
+
+// reads a field through the instance's shape
+bool getField (ObjInstance* instance, ObjString* name, Value* value) {
+    Value slot;
+    if (!tableGet(&instance->shape->slots, name, &slot)) return false;
+
+    *value = instance->fields[(int)AS_NUMBER(slot)];
+    return true;
+}
+
+// writes a field, moving the instance to a new shape if it doesn't have the field yet; the caller keeps
+// the instance and value reachable since the transition and the field array may allocate
+void setField (ObjInstance* instance, ObjString* name, Value value) {
+    Value slot;
+    if (tableGet(&instance->shape->slots, name, &slot)) {
+        instance->fields[(int)AS_NUMBER(slot)] = value;
+        writeBarrierValue((Obj*)instance, value);
+        return;
+    }
+
+    addField(instance, shapeAddField(instance->shape, name), value);
+}
+
+// moves the instance to shape, a child of its current shape, storing value in the field the transition added
+void addField (ObjInstance* instance, ObjShape* shape, Value value) {
+    if (shape->fieldCount > instance->fieldCapacity) {
+        int oldCapacity = instance->fieldCapacity;
+        int capacity    = GROW_CAPACITY(oldCapacity);
+        instance->fields = GROW_ARRAY(Value, instance->fields, oldCapacity, capacity);
+        instance->fieldCapacity = capacity;
+    }
+
+    instance->fields[shape->fieldCount - 1] = value;
+    instance->shape = shape;
+    writeBarrierValue((Obj*)instance, value);
+    writeBarrier((Obj*)instance, (Obj*)shape);
+
+    ObjClass* klass = instance->klass;
+    if (shape->fieldCount > klass->instanceFields) klass->instanceFields = shape->fieldCount;
+}
+
 // allocates memory for a string
-static ObjString* allocateString (char* chars, int length, uint32_t hash) { // added in ch20
+// static ObjString* allocateString (char* chars, int length, uint32_t hash) { // added in ch20
 // static ObjString* allocateString (char* chars, int length) {
+static ObjString* allocateString (char* chars, int length, uint32_t hash, bool literal) {
     ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
     string->length = length;
     string->chars = chars;
     string->hash = hash; // added in ch20
+    string->literal = literal;
 
     push(OBJ_VAL(string)); // added in ch26
     tableSet(&vm.strings, string, NIL_VAL); // added in ch20
+    rememberString(string);
     pop(); // added in ch26
 
     return string;
@@ -112,7 +197,7 @@ ObjString* takeString (char* chars, int length) {
         FREE_ARRAY(char, chars, length + 1);
         return interned;
     }
-    return allocateString(chars, length, hash); // added in ch20 
+    return allocateString(chars, length, hash, false); // added in ch20 
 } // added in ch19
 
 // copies a string and creates an ObjString
@@ -125,7 +210,52 @@ ObjString* copyString (const char* chars, int length) {
     memcpy(heapChars, chars, length);
     heapChars[length] = '\0';
     // return allocateString(heapChars, length);
-    return allocateString(heapChars, length, hash); // added in ch20
+    return allocateString(heapChars, length, hash, false); // added in ch20
+}
+
+// returns room for length characters in the literal arena, starting a new block when the current one is
+// full. a literal bigger than a block gets a block to itself
+static char* allocateLiteral (size_t length) {
+    LiteralBlock* block = vm.literals;
+    if (block == NULL || block->count + length > block->capacity) {
+        size_t capacity = length > LITERAL_BLOCK_SIZE ? length : LITERAL_BLOCK_SIZE;
+        block = (LiteralBlock*)malloc(sizeof(LiteralBlock) + capacity);
+        if (block == NULL) exit(1);
+
+        block->next     = vm.literals;
+        block->count    = 0;
+        block->capacity = capacity;
+        vm.literals     = block;
+    }
+
+    char* chars = (char*)(block + 1) + block->count;
+    block->count += length;
+    return chars;
+}
+
+// copies a string that comes from program text (a literal, an identifier, a name in a .loxc file). its
+// characters go in the literal arena, which is never collected, so they are copied once per distinct
+// string and never freed on their own
+ObjString* copyLiteral (const char* chars, int length) {
+    uint32_t   hash     = hashString(chars, length);
+    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    if (interned != NULL) return interned;
+
+    char* arenaChars = allocateLiteral(length + 1);
+    memcpy(arenaChars, chars, length);
+    arenaChars[length] = '\0';
+    return allocateString(arenaChars, length, hash, true);
+}
+
+// frees every block of the literal arena
+void freeLiterals () {
+    LiteralBlock* block = vm.literals;
+    while (block != NULL) {
+        LiteralBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    vm.literals = NULL;
 }
 
 // instantiates a new upvalue
@@ -172,6 +302,10 @@ void printObject (Value value) {
             printf("%s instance", AS_INSTANCE(value)->klass->name->chars);
             break;
 
+        case OBJ_SHAPE:
+            printf("shape");
+            break;
+
         case OBJ_NATIVE: // added in ch24
             // printf("<native fn>");
             std::cout << "<native fn>";
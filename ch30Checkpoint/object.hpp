@@ -14,6 +14,7 @@
 #define IS_FUNCTION(value)     isObjType(value, OBJ_FUNCTION)     // added in ch24
 #define IS_INSTANCE(value)     isObjType(value, OBJ_INSTANCE)     // added in ch27
 #define IS_NATIVE(value)       isObjType(value, OBJ_NATIVE)       // added in ch24
+#define IS_SHAPE(value)        isObjType(value, OBJ_SHAPE)
 #define IS_STRING(value)       isObjType(value, OBJ_STRING)
 
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod*)AS_OBJ(value))        // added in ch28
@@ -22,6 +23,7 @@
 #define AS_FUNCTION(value)     ((ObjFunction*)AS_OBJ(value))           // added in ch24
 #define AS_INSTANCE(value)     ((ObjInstance*)AS_OBJ(value))           // added in ch27
 #define AS_NATIVE(value)       (((ObjNative*)AS_OBJ(value))->function) // added in ch24
+#define AS_SHAPE(value)        ((ObjShape*)AS_OBJ(value))
 #define AS_STRING(value)       ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value)      (((ObjString*)AS_OBJ(value))->chars)
 
@@ -33,14 +35,16 @@ typedef enum {
     OBJ_FUNCTION,     // added in ch24
     OBJ_INSTANCE,     // added in ch27
     OBJ_NATIVE,       // added in ch24
+    OBJ_SHAPE,
     OBJ_STRING,
     OBJ_UPVALUE       // added in ch25
 } ObjType;
 
-// represents an object
+// represents an object. the heap page it sits in keeps its mark bit and records that it is live, so
+// there is no list of objects to chain it into
 struct Obj {    
-    struct Obj* next;
-    bool        isMarked; // added in ch26
+    // struct Obj* next;
+    // bool        isMarked; // added in ch26
     ObjType     type;
 };
 
@@ -49,6 +53,7 @@ typedef struct { // added in ch24
     Obj        obj;
     int        arity;
     int        upvalueCount; // added in ch25
+    int        maxSlots;     // deepest the stack gets inside a call, counted from the frame's first slot
     Chunk      chunk;
     ObjString* name;
 } ObjFunction;
@@ -66,9 +71,19 @@ struct ObjString {
     Obj      obj;
     int      length;
     char*    chars;
-    uint32_t hash; // added in ch20
+    uint32_t hash;    // added in ch20
+    bool     literal; // chars live in the literal arena rather than an allocation of their own
 };
 
+// a block of the literal arena. the characters of strings copied out of program text are bump-allocated
+// here, so a script with many literals doesn't make one allocation per literal; blocks live as long as
+// the VM, and the characters follow the header
+typedef struct LiteralBlock {
+    struct LiteralBlock* next;
+    size_t               count;
+    size_t               capacity;
+} LiteralBlock;
+
 // represents an upvalue object
 typedef struct ObjUpvalue { // added in ch25
     Obj                obj;
@@ -85,18 +100,33 @@ typedef struct { // added in ch25
     int          upvalueCount;
 } ObjClosure;
 
+// represents the field layout shared by every instance that added the same fields in the same order;
+// adding a field moves an instance along a transition to the child shape
+typedef struct ObjShape {
+    Obj              obj;
+    struct ObjShape* parent;      // NULL for a class's root shape
+    ObjString*       name;        // field the transition from parent added
+    int              fieldCount;
+    Table            transitions; // field name -> child shape
+    Table            slots;       // field name -> slot index, for every field in the layout
+} ObjShape;
+
 // represents a class object
 typedef struct { // added in ch27
     Obj        obj;
     ObjString* name;
-    Table      methods; // added in ch28
+    Table      methods;        // added in ch28
+    ObjShape*  shape;          // root shape of its instances
+    int        instanceFields; // most fields an instance has grown to; new instances start with that room
 } ObjClass;
 
 // represents an instance object
 typedef struct { // added in ch27
     Obj       obj;
     ObjClass* klass;
-    Table     fields; 
+    ObjShape* shape;
+    Value*    fields;        // indexed by the shape's slot numbers
+    int       fieldCapacity;
 } ObjInstance;
 
 // represents a bound method object
@@ -112,8 +142,15 @@ ObjClosure*        newClosure     (ObjFunction* function);              // added
 ObjFunction*       newFunction    ();                                   // added in ch24
 ObjInstance*       newInstance    (ObjClass* klass);                    // added in ch27
 ObjNative*         newNative      (NativeFn function);                  // added in ch24
+ObjShape*          newShape       (ObjShape* parent, ObjString* name);
+ObjShape*          shapeAddField  (ObjShape* shape, ObjString* name);
+bool               getField       (ObjInstance* instance, ObjString* name, Value* value);
+void               setField       (ObjInstance* instance, ObjString* name, Value value);
+void               addField       (ObjInstance* instance, ObjShape* shape, Value value);
 ObjString*         takeString     (char* chars, int length);
 ObjString*         copyString     (const char* chars, int length);
+ObjString*         copyLiteral    (const char* chars, int length);
+void               freeLiterals   ();
 ObjUpvalue*        newUpvalue     (Value* slot);                        // added in ch25
 void               printObject    (Value value);
 static inline bool isObjType      (Value value, ObjType type) { return IS_OBJ(value) && AS_OBJ(value)->type == type; }
@@ -0,0 +1,507 @@
+#include <string.h>
+
+#include "memory.hpp"
+#include "object.hpp"
+#include "optimizer.hpp"
+
+// returns the size in bytes of the instruction at offset, operands included
+int instructionLength (Chunk* chunk, int offset) {
+    switch (chunk->code[offset]) {
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_CONSTANT:
+        case OP_GET_SUPER:
+        case OP_CALL:
+        case OP_CLASS:
+        case OP_METHOD:
+        case OP_SET_LOCAL_POP:
+        case OP_POPN:
+        case OP_TAIL_CALL:
+            return 2;
+
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_TRUE:
+        case OP_JUMP_IF_FALSE_OR_POP:
+        case OP_JUMP_IF_TRUE_OR_POP:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_LESS:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_GREATER:
+        case OP_JUMP_IF_NOT_EQUAL:
+        case OP_JUMP_IF_EQUAL:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_REG_MOVE:
+        case OP_REG_LOAD_CONSTANT:
+        case OP_ADD_LOCALS:
+        case OP_ADD_LOCAL_CONSTANT:
+        case OP_SUBTRACT_LOCAL_CONSTANT:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_GET_THIS_PROPERTY:
+        case OP_GET_LOCAL_LONG:
+        case OP_SET_LOCAL_LONG:
+        case OP_GET_UPVALUE_LONG:
+        case OP_SET_UPVALUE_LONG:
+            return 3;
+
+        case OP_REG_ADD:
+        case OP_REG_SUBTRACT:
+        case OP_REG_MULTIPLY:
+        case OP_REG_DIVIDE:
+        case OP_REG_ADD_CONSTANT:
+        case OP_REG_SUBTRACT_CONSTANT:
+        case OP_REG_MULTIPLY_CONSTANT:
+        case OP_REG_DIVIDE_CONSTANT:
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE:
+        case OP_CONSTANT_LONG:
+        case OP_CLASS_LONG:
+        case OP_METHOD_LONG:
+        case OP_GET_SUPER_LONG:
+            return 4;
+
+        case OP_LONG_JUMP:
+            return 5;
+
+        // the capture pairs follow the constant, each two bytes or three for a wide index
+        case OP_CLOSURE:
+        case OP_CLOSURE_LONG: {
+            bool         wide     = chunk->code[offset] == OP_CLOSURE_LONG;
+            int          constant = wide ? readLongOperand(chunk->code + offset + 1) : chunk->code[offset + 1];
+            int          length   = wide ? 4 : 2;
+            ObjFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
+            for (int i = 0; i < function->upvalueCount; i++) {
+                length += chunk->code[offset + length] & CAPTURE_WIDE ? 3 : 2;
+            }
+            return length;
+        }
+
+        default:
+            return 1;
+    }
+}
+
+// returns the offset a jump instruction lands on, or -1 if the instruction isn't a jump
+static int jumpTarget (Chunk* chunk, int offset) {
+    uint8_t* code = chunk->code + offset;
+
+    switch (code[0]) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_TRUE:
+        case OP_JUMP_IF_FALSE_OR_POP:
+        case OP_JUMP_IF_TRUE_OR_POP:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_LESS:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_GREATER:
+        case OP_JUMP_IF_NOT_EQUAL:
+        case OP_JUMP_IF_EQUAL: return offset + 3 + ((code[1] << 8) | code[2]);
+        case OP_LOOP:          return offset + 3 - ((code[1] << 8) | code[2]);
+        case OP_LONG_JUMP: {
+            int distance = readLongOperand(code + 2);
+            return code[1] == OP_LOOP ? offset + 5 - distance : offset + 5 + distance;
+        }
+        default:               return -1;
+    }
+}
+
+// jumpTarget() for a chunk as the compiler left it, where a far jump's operand is a placeholder and its
+// real target is kept in farTarget instead
+static int sourceTarget (Chunk* chunk, const int* farTarget, int offset) {
+    return farTarget[offset] >= 0 ? farTarget[offset] : jumpTarget(chunk, offset);
+}
+
+// follows a jump target through any unconditional jumps it lands on to where the chain ends; the hop
+// limit stops on loops that jump to themselves, like an empty `for (;;)`
+static int finalTarget (Chunk* chunk, const int* farTarget, int target) {
+    for (int hops = 0; hops < 16 && target < chunk->count; hops++) {
+        uint8_t instruction = chunk->code[target];
+        if (instruction != OP_JUMP && instruction != OP_LOOP) break;
+        target = sourceTarget(chunk, farTarget, target);
+    }
+    return target;
+}
+
+// matches a fused sequence starting at offset and writes the replacement into out, returning how many
+// source bytes it covers (0 when nothing matches); a sequence never swallows the target of a jump. a
+// replacement ending in a jump sets carriedJump to the source jump whose target it keeps
+static int fuseInstructions (Chunk* chunk, int offset, const bool* isTarget, uint8_t* out, int* outLength,
+                             int* carriedJump) {
+    uint8_t* code  = chunk->code + offset;
+    int      count = chunk->count - offset;
+
+    switch (code[0]) {
+        // a value pushed only to be popped again
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+        case OP_GET_UPVALUE: {
+            int length = instructionLength(chunk, offset);
+            if (count <= length || isTarget[offset + length] || code[length] != OP_POP) return 0;
+            *outLength = 0;
+            return length + 1;
+        }
+
+        case OP_GET_LOCAL: {
+            if (count < 3 || isTarget[offset + 2]) return 0;
+
+            if (code[2] == OP_POP) {
+                *outLength = 0;
+                return 3;
+            }
+
+            // this.field inside a method
+            if (code[1] == 0 && code[2] == OP_GET_PROPERTY) {
+                out[0] = OP_GET_THIS_PROPERTY;
+                out[1] = code[3];
+                out[2] = code[4];
+                *outLength = 3;
+                return 5;
+            }
+
+            if (count < 5 || isTarget[offset + 4]) return 0;
+            if (code[2] == OP_GET_LOCAL && code[4] == OP_ADD) {
+                out[0] = OP_ADD_LOCALS;
+            }
+            else if (code[2] == OP_CONSTANT && code[4] == OP_ADD) {
+                out[0] = OP_ADD_LOCAL_CONSTANT;
+            }
+            else if (code[2] == OP_CONSTANT && code[4] == OP_SUBTRACT) {
+                out[0] = OP_SUBTRACT_LOCAL_CONSTANT;
+            }
+            else { return 0; }
+
+            out[1] = code[1];
+            out[2] = code[3];
+            *outLength = 3;
+            return 5;
+        }
+
+        case OP_SET_LOCAL: {
+            if (count < 3 || isTarget[offset + 2] || code[2] != OP_POP) return 0;
+            out[0] = OP_SET_LOCAL_POP;
+            out[1] = code[1];
+            *outLength = 2;
+            return 3;
+        }
+
+        case OP_POP: {
+            int run = 1;
+            while (run < count && run < UINT8_MAX && code[run] == OP_POP && !isTarget[offset + run]) run++;
+            if (run < 2) return 0;
+            out[0] = OP_POPN;
+            out[1] = (uint8_t)run;
+            *outLength = 2;
+            return run;
+        }
+
+        case OP_NOT: {
+            if (count < 4 || isTarget[offset + 1] || code[1] != OP_POP_JUMP_IF_FALSE) return 0;
+            out[0] = OP_POP_JUMP_IF_TRUE;
+            out[1] = code[2];
+            out[2] = code[3];
+            *outLength   = 3;
+            *carriedJump = offset + 1;
+            return 4;
+        }
+
+        default:
+            return 0;
+    }
+}
+
+// returns where offset in the rewritten code ends up once the jumps before it have widened; jumpAt is in
+// ascending order and grown[i] is how far jump i has moved, so offset moves as far as the first jump at
+// or after it
+static int shiftedOffset (const int* jumpAt, const int* grown, int jumpCount, int offset) {
+    int low  = 0;
+    int high = jumpCount;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (jumpAt[mid] < offset) low = mid + 1;
+        else high = mid;
+    }
+    return offset + grown[low];
+}
+
+// rewrites a finished chunk in place: common instruction sequences become superinstructions, pushes that
+// are popped straight away and runs of pops shrink, and jumps landing on unconditional jumps go straight
+// to the end of the chain. every jump is re-patched, widening to a LONG_JUMP when its distance still
+// doesn't fit 16 bits, and the line table follows the bytes it describes
+void optimizeChunk (Chunk* chunk, FarJump* farJumps, int farJumpCount) {
+    int count = chunk->count;
+    if (count == 0) return;
+
+    bool*    isTarget  = ALLOCATE(bool, count + 1);
+    int*     newOffset = ALLOCATE(int, count + 1);
+    int*     farTarget = ALLOCATE(int, count);
+    int*     jumpAt    = ALLOCATE(int, count); // new offset of each jump
+    int*     jumpTo    = ALLOCATE(int, count); // and the old offset it lands on
+    uint8_t* code      = ALLOCATE(uint8_t, count);
+    int*     lines     = ALLOCATE(int, count);
+    memset(isTarget, 0, sizeof(bool) * (count + 1));
+    for (int i = 0; i < count; i++) farTarget[i] = -1;
+    for (int i = 0; i < farJumpCount; i++) farTarget[farJumps[i].at] = farJumps[i].target;
+
+    for (int offset = 0; offset < count; offset += instructionLength(chunk, offset)) {
+        int target = sourceTarget(chunk, farTarget, offset);
+        if (target >= 0) isTarget[target] = true;
+    }
+
+    int length    = 0;
+    int jumpCount = 0;
+    int offset    = 0;
+    while (offset < count) {
+        newOffset[offset] = length;
+
+        int fusedLength;
+        int carriedJump = -1;
+        int consumed    = fuseInstructions(chunk, offset, isTarget, code + length, &fusedLength, &carriedJump);
+        int jump        = length + fusedLength - 3;
+        if (consumed == 0) {
+            consumed    = instructionLength(chunk, offset);
+            fusedLength = consumed;
+            memcpy(code + length, chunk->code + offset, consumed);
+            carriedJump = offset;
+            jump        = length;
+        }
+
+        int target = carriedJump >= 0 ? sourceTarget(chunk, farTarget, carriedJump) : -1;
+        if (target >= 0) {
+            // an unconditional jump can change direction to reach the end of the chain; a conditional one
+            // only ever jumps forward, so it stops short when the chain leads backward. a far jump stays
+            // where the compiler aimed it
+            int  threaded = finalTarget(chunk, farTarget, target);
+            bool forward  = threaded > carriedJump;
+            int  distance = forward ? threaded - (carriedJump + 3) : carriedJump + 3 - threaded;
+            if (distance <= UINT16_MAX) {
+                if (code[jump] == OP_JUMP || code[jump] == OP_LOOP) {
+                    code[jump] = forward ? OP_JUMP : OP_LOOP;
+                    target     = threaded;
+                }
+                else if (forward) { target = threaded; }
+            }
+
+            jumpAt[jumpCount] = jump;
+            jumpTo[jumpCount] = target;
+            jumpCount++;
+        }
+
+        int line = getLine(chunk, offset);
+        for (int i = 0; i < fusedLength; i++) lines[length + i] = line;
+        for (int i = 1; i < consumed; i++) newOffset[offset + i] = length;
+        length += fusedLength;
+        offset += consumed;
+    }
+    newOffset[count] = length;
+
+    // widening a jump moves everything after it two bytes along, which can carry other jumps out of range,
+    // so keep widening until nothing more needs it
+    bool* wide  = ALLOCATE(bool, jumpCount + 1);
+    int*  grown = ALLOCATE(int, jumpCount + 1);
+    memset(wide, 0, sizeof(bool) * (jumpCount + 1));
+    for (bool widened = true; widened; ) {
+        widened  = false;
+        grown[0] = 0;
+        for (int i = 0; i < jumpCount; i++) grown[i + 1] = grown[i] + (wide[i] ? 2 : 0);
+
+        for (int i = 0; i < jumpCount; i++) {
+            if (wide[i]) continue;
+            int at     = jumpAt[i] + grown[i];
+            int target = shiftedOffset(jumpAt, grown, jumpCount, newOffset[jumpTo[i]]);
+
+            int distance = code[jumpAt[i]] == OP_LOOP ? at + 3 - target : target - (at + 3);
+            if (distance > UINT16_MAX) wide[i] = widened = true;
+        }
+    }
+
+    int finalLength = length + grown[jumpCount];
+    if (finalLength > chunk->capacity) {
+        int oldCapacity = chunk->capacity;
+        chunk->capacity = finalLength;
+        chunk->code     = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
+    }
+
+    // copy the rewritten code back, patching each jump (and spreading out the wide ones) on the way. the
+    // line table is rebuilt from scratch as the bytes go in
+    int from = 0;
+    chunk->lineCount = 0;
+    for (int i = 0; i <= jumpCount; i++) {
+        int end = i < jumpCount ? jumpAt[i] : length;
+        memcpy(chunk->code + from + grown[i], code + from, end - from);
+        for (int j = from; j < end; j++) addLine(chunk, j + grown[i], lines[j]);
+        if (i == jumpCount) break;
+
+        int      at     = end + grown[i];
+        int      target = shiftedOffset(jumpAt, grown, jumpCount, newOffset[jumpTo[i]]);
+        uint8_t  kind   = code[end];
+        uint8_t* out    = chunk->code + at;
+        int      size   = wide[i] ? 5 : 3;
+        int      jump   = kind == OP_LOOP ? at + size - target : target - (at + size);
+        if (wide[i]) {
+            out[0] = OP_LONG_JUMP;
+            out[1] = kind;
+            out[2] = (jump >> 16) & 0xff;
+            out[3] = (jump >> 8) & 0xff;
+            out[4] = jump & 0xff;
+        }
+        else {
+            out[0] = kind;
+            out[1] = (jump >> 8) & 0xff;
+            out[2] = jump & 0xff;
+        }
+        addLine(chunk, at, lines[end]);
+        from = end + 3;
+    }
+    chunk->count = finalLength;
+
+    FREE_ARRAY(bool, isTarget, count + 1);
+    FREE_ARRAY(int, newOffset, count + 1);
+    FREE_ARRAY(int, farTarget, count);
+    FREE_ARRAY(int, jumpAt, count);
+    FREE_ARRAY(int, jumpTo, count);
+    FREE_ARRAY(uint8_t, code, count);
+    FREE_ARRAY(int, lines, count);
+    FREE_ARRAY(bool, wide, jumpCount + 1);
+    FREE_ARRAY(int, grown, jumpCount + 1);
+}
+
+// returns how an instruction changes the stack height, reading argument counts where they matter
+static int stackEffect (Chunk* chunk, int offset) {
+    uint8_t* code = chunk->code + offset;
+
+    switch (code[0]) {
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_CLOSURE:
+        case OP_CLASS:
+        case OP_ADD_LOCALS:
+        case OP_ADD_LOCAL_CONSTANT:
+        case OP_SUBTRACT_LOCAL_CONSTANT:
+        case OP_GET_THIS_PROPERTY:
+        case OP_CONSTANT_LONG:
+        case OP_GET_LOCAL_LONG:
+        case OP_GET_UPVALUE_LONG:
+        case OP_CLOSURE_LONG:
+        case OP_CLASS_LONG:
+            return 1;
+
+        case OP_POP:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_PRINT:
+        case OP_CLOSE_UPVALUE:
+        case OP_INHERIT:
+        case OP_METHOD:
+        case OP_SET_LOCAL_POP:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_TRUE:
+        case OP_ADD_NUMBER:
+        case OP_SUBTRACT_NUMBER:
+        case OP_LESS_NUMBER:
+        case OP_GREATER_NUMBER:
+        case OP_METHOD_LONG:
+        case OP_GET_SUPER_LONG:
+            return -1;
+
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_LESS:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_GREATER:
+        case OP_JUMP_IF_NOT_EQUAL:
+        case OP_JUMP_IF_EQUAL:
+            return -2;
+
+        case OP_POPN:
+        case OP_CALL:
+        case OP_TAIL_CALL:    return -code[1];
+        case OP_INVOKE:       return -code[1];
+        case OP_SUPER_INVOKE: return -code[1] - 1;
+        case OP_LONG_JUMP:    return stackEffect(chunk, offset + 1); // as the kind of jump it stands for
+
+        default:
+            return 0;
+    }
+}
+
+// returns the deepest the stack gets while the chunk runs, counting from the base of its frame; entry is
+// the height on entry (the callee slot plus its parameters). every path into an instruction arrives at
+// the same height, so one walk over the control flow is enough. code that didn't come from the compiler
+// can pass balanced, which is cleared if a path pops into the callee slot or two paths meet at different
+// heights
+int maxStackDepth (Chunk* chunk, int entry, bool* balanced) {
+    int count = chunk->count;
+    if (count == 0) return entry;
+
+    int* height  = ALLOCATE(int, count);
+    int* pending = ALLOCATE(int, count);
+    for (int i = 0; i < count; i++) height[i] = -1;
+
+    int pendingCount = 0;
+    int deepest      = entry;
+    height[0]               = entry;
+    pending[pendingCount++] = 0;
+
+    while (pendingCount > 0) {
+        int offset = pending[--pendingCount];
+        int depth  = height[offset];
+        int next   = offset + instructionLength(chunk, offset);
+        int target = jumpTarget(chunk, offset);
+        int after  = depth + stackEffect(chunk, offset);
+        if (after > deepest) deepest = after;
+
+        // the short-circuit jumps keep their operand when they branch and pop it when they fall through
+        int taken = after;
+        uint8_t instruction = chunk->code[offset];
+        if (instruction == OP_LONG_JUMP) instruction = chunk->code[offset + 1];
+        if (instruction == OP_JUMP_IF_FALSE_OR_POP || instruction == OP_JUMP_IF_TRUE_OR_POP) {
+            taken = depth;
+            after = depth - 1;
+        }
+
+        bool fallsThrough = instruction != OP_RETURN && instruction != OP_JUMP && instruction != OP_LOOP;
+        if (balanced != NULL) {
+            if (taken < 1 || after < 1) *balanced = false;
+            if (target >= 0 && target < count && height[target] >= 0 && height[target] != taken) *balanced = false;
+            if (fallsThrough && next < count && height[next] >= 0 && height[next] != after) *balanced = false;
+        }
+
+        if (target >= 0 && target < count && height[target] < 0) {
+            height[target] = taken;
+            pending[pendingCount++] = target;
+        }
+
+        if (fallsThrough && next < count && height[next] < 0) {
+            height[next] = after;
+            pending[pendingCount++] = next;
+        }
+    }
+
+    FREE_ARRAY(int, height, count);
+    FREE_ARRAY(int, pending, count);
+    return deepest;
+}
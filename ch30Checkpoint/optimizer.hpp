@@ -0,0 +1,17 @@
+#ifndef clox_optimizer_hpp
+#define clox_optimizer_hpp
+
+#include "chunk.hpp"
+
+// a jump whose distance didn't fit its 16-bit operand when the compiler emitted it: at is the offset of
+// the jump instruction and target the offset it lands on. optimizeChunk() widens it to a LONG_JUMP
+typedef struct {
+    int at;
+    int target;
+} FarJump;
+
+int  instructionLength (Chunk* chunk, int offset);
+void optimizeChunk     (Chunk* chunk, FarJump* farJumps, int farJumpCount);
+int  maxStackDepth     (Chunk* chunk, int entry, bool* balanced = NULL);
+
+#endif
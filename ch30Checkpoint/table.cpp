@@ -16,10 +16,12 @@ void initTable (Table* table) {
     table->count = 0;
     table->capacity = 0;
     table->entries = NULL;
+    table->remembered = false;
 }
 
 // frees the table
 void freeTable (Table* table) {
+    if (table->remembered) forgetTable(table);
     FREE_ARRAY(Entry, table->entries, table->capacity);
     initTable(table);
 }
@@ -100,6 +102,7 @@ bool tableSet (Table* table, ObjString* key, Value value) {
 
     entry->key = key;
     entry->value = value;
+    if (!table->remembered && (!isMarked((Obj*)key) || (IS_OBJ(value) && !isMarked(AS_OBJ(value))))) writeBarrierTable(table, key, value);
 
     return isNewKey;
 }
@@ -152,7 +155,7 @@ ObjString* tableFindString (Table* table, const char* chars, int length, uint32_
 void tableRemoveWhite(Table* table) { // added in ch26
     for (int i = 0; i < table->capacity; i++) {
         Entry* entry = &table->entries[i];
-        if (entry->key != NULL && !entry->key->obj.isMarked) { tableDelete(table, entry->key); }
+        if (entry->key != NULL && !isMarked((Obj*)entry->key)) { tableDelete(table, entry->key); }
     }
 }
 
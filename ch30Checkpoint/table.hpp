@@ -18,6 +18,7 @@ typedef struct {
     int    count;
     int    capacity;
     Entry* entries;
+    bool   remembered; // on the collector's remembered set
 } Table;
 
 void initTable             (Table* table);
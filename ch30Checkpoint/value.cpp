@@ -13,6 +13,7 @@ void initValueArray (ValueArray* array) {
     array->values = NULL;
     array->capacity = 0;
     array->count = 0;
+    array->remembered = false;
 }
 
 // writes the value array
@@ -25,10 +26,12 @@ void writeValueArray (ValueArray* array, Value value) {
 
     array->values[array->count] = value;
     array->count++;
+    if (!array->remembered && IS_OBJ(value) && !isMarked(AS_OBJ(value))) writeBarrierArray(array, value);
 }
 
 // frees the value array
 void freeValueArray (ValueArray* array) {
+    if (array->remembered) forgetArray(array);
     FREE_ARRAY(Value, array->values, array->capacity);
     initValueArray(array);
 }   
@@ -50,6 +53,8 @@ void printValue (Value value) { // updated in ch18
         case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
         
         case VAL_OBJ:    printObject(value); break; // added in ch19
+
+        case VAL_UNDEFINED: break;
     }
 
     #endif // added in ch30
@@ -15,11 +15,13 @@ typedef struct ObjString ObjString; // added in ch19
     #define TAG_NIL   1 
     #define TAG_FALSE 2 
     #define TAG_TRUE  3
+    #define TAG_UNDEFINED 4 // global slot reserved by the compiler but not defined yet; never visible to Lox code
 
     typedef uint64_t Value;
 
     #define IS_BOOL(value)      (((value) | 1) == TRUE_VAL)
     #define IS_NIL(value)       ((value) == NIL_VAL)
+    #define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
     #define IS_NUMBER(value)    (((value) & QNAN) != QNAN)
     #define IS_OBJ(value)       (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
 
@@ -31,6 +33,7 @@ typedef struct ObjString ObjString; // added in ch19
     #define FALSE_VAL           ((Value)(uint64_t)(QNAN | TAG_FALSE))
     #define TRUE_VAL            ((Value)(uint64_t)(QNAN | TAG_TRUE))    
     #define NIL_VAL             ((Value)(uint64_t)(QNAN | TAG_NIL))
+    #define UNDEFINED_VAL       ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
     #define NUMBER_VAL(num)     numToValue(num)
     #define OBJ_VAL(obj)        (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
 
@@ -54,7 +57,8 @@ typedef enum { // added in ch18
     VAL_BOOL,
     VAL_NIL,
     VAL_NUMBER,
-    VAL_OBJ // added in ch19
+    VAL_OBJ, // added in ch19
+    VAL_UNDEFINED
 } ValueType;
 
 // typedef double Value;
@@ -71,6 +75,7 @@ typedef struct { // added in ch18
 #define IS_NIL(value)    ((value).type == VAL_NIL) // added in ch18
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER) // added in ch18
 #define IS_OBJ(value)    ((value).type == VAL_OBJ) // added in ch19
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
 
 #define AS_OBJ(value)     ((value).as.obj) // added in ch19
 #define AS_BOOL(value)   ((value).as.boolean) // added in ch18
@@ -78,6 +83,7 @@ typedef struct { // added in ch18
 
 #define BOOL_VAL(value)   ((Value){ VAL_BOOL, { .boolean = value } }) // added the next two lines in ch18
 #define NIL_VAL           ((Value){ VAL_NIL, { .number = 0 } })
+#define UNDEFINED_VAL     ((Value){ VAL_UNDEFINED, { .number = 0 } })
 #define NUMBER_VAL(value) ((Value){ VAL_NUMBER, { .number = value } })
 #define OBJ_VAL(object)   ((Value){VAL_OBJ, {.obj = (Obj*)object}}) // added in ch19
 
@@ -88,6 +94,7 @@ typedef struct {
     int    capacity;
     int    count;
     Value* values;
+    bool   remembered; // on the collector's remembered set
 } ValueArray;
 
 bool valuesEqual     (Value a, Value b); // added in ch18
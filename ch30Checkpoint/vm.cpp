@@ -22,6 +22,9 @@ static void resetStack () {
     vm.openUpvalues = NULL; // added in ch25
 } 
 
+// frames printed from each end of a runtime error's stack trace
+#define TRACE_FRAMES 16
+
 // for runtime errors 
 static void runtimeError (const char* format, ...) { // added in ch18
     va_list args;
@@ -31,11 +34,17 @@ static void runtimeError (const char* format, ...) { // added in ch18
     fputs("\n", stderr);
 
     for (int i = vm.frameCount - 1; i >= 0; i--) { // added in ch24
+        // deep recursion would print thousands of identical lines, so only both ends of the trace are kept
+        if (i == vm.frameCount - 1 - TRACE_FRAMES && i >= TRACE_FRAMES) {
+            fprintf(stderr, "[... %d more frames]\n", i - TRACE_FRAMES + 1);
+            i = TRACE_FRAMES - 1;
+        }
+
         CallFrame* frame = &vm.frames[i];
         // ObjFunction* function = frame->function;
         ObjFunction* function = frame->closure->function; // modified in ch25
-        size_t instruction = frame->ip - function->chunk.code - 1;
-        fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
+        size_t instruction = frame->ip - frame->code - 1;
+        fprintf(stderr, "[line %d] in ", getLine(&function->chunk, (int)instruction));
         if (function->name == NULL) fprintf(stderr, "script\n");
         else fprintf(stderr, "%s()\n", function->name->chars);
     }
@@ -56,24 +65,51 @@ static void runtimeError (const char* format, ...) { // added in ch18
 static void defineNative (const char* name, NativeFn function) {
     push(OBJ_VAL(copyString(name, (int)strlen(name))));
     push(OBJ_VAL(newNative(function)));
-    tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+    // tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+    int slot = globalSlot(AS_STRING(vm.stack[0]));
+    vm.globalValues.values[slot] = vm.stack[1];
     pop();
     pop();
 }
 
 // initializes the VM
-void initVM () {
+// void initVM () {
+void initVM (int framesMax, int stackMax, int gcMaxPause, int markThreads) {
+    vm.framesMax     = framesMax;
+    vm.frameCapacity = framesMax < FRAMES_INIT ? framesMax : FRAMES_INIT;
+    vm.frames        = (CallFrame*)malloc(sizeof(CallFrame) * vm.frameCapacity);
+    vm.stackMax      = stackMax;
+    vm.stackCapacity = stackMax < STACK_INIT ? stackMax : STACK_INIT;
+    vm.stack         = (Value*)malloc(sizeof(Value) * vm.stackCapacity);
+    if (vm.frames == NULL || vm.stack == NULL) exit(1);
+
     resetStack();
-    vm.objects = NULL;                     // added in ch19
+    // vm.objects = NULL;                  // added in ch19
+    initHeap(&vm.heap);
     vm.bytesAllocated = 0;                 // added in ch26
     vm.nextGC = 1024 * 1024;               // added in ch26
+    vm.nextFullGC = 1024 * 1024;
+    vm.gcPhase = GC_IDLE;
+    vm.gcMaxPause = (uint64_t)gcMaxPause * 1000;
+    vm.markThreads = markThreads < GC_MARKERS_MAX ? markThreads : GC_MARKERS_MAX;
 
     vm.grayCount = 0;                      // added in ch26
     vm.grayCapacity = 0;                   // added in ch26
     vm.grayStack = NULL;                   // added in ch26
-
-    initTable(&vm.globals);                // added in ch21
+    memset(&vm.rememberedObjects, 0, sizeof(GCList));
+    memset(&vm.rememberedTables, 0, sizeof(GCList));
+    memset(&vm.rememberedArrays, 0, sizeof(GCList));
+    memset(&vm.youngStrings, 0, sizeof(GCList));
+
+    vm.cacheHits = 0;
+    vm.cacheMisses = 0;
+    vm.cacheMegamorphic = 0;
+
+    initTable(&vm.globalSlots);
+    initValueArray(&vm.globalNames);
+    initValueArray(&vm.globalValues);
     initTable(&vm.strings);                // added in ch20
+    vm.literals = NULL;
 
     vm.initString = NULL;                  // added in ch28
     vm.initString = copyString("init", 4); // added in ch28
@@ -83,12 +119,36 @@ void initVM () {
 
 // frees the VM
 void freeVM () { 
-    freeTable(&vm.globals); // added in ch21
+    #ifdef DEBUG_LOG_CACHE
+        printf("-- inline caches: %zu hits, %zu misses, %zu megamorphic\n", vm.cacheHits, vm.cacheMisses, vm.cacheMegamorphic);
+    #endif
+
+    freeTable(&vm.globalSlots);
+    freeValueArray(&vm.globalNames);
+    freeValueArray(&vm.globalValues);
     freeTable(&vm.strings); // added in ch20
     vm.initString = NULL;   // added in ch28
     freeObjects(); 
+    freeLiterals();
+
+    free(vm.frames);
+    free(vm.stack);
 } // updated in ch21
 
+// returns the slot of the global called name, reserving an undefined one the first time the name comes up
+int globalSlot (ObjString* name) {
+    Value slot;
+    if (tableGet(&vm.globalSlots, name, &slot)) return (int)AS_NUMBER(slot);
+
+    push(OBJ_VAL(name));
+    int index = vm.globalValues.count;
+    writeValueArray(&vm.globalValues, UNDEFINED_VAL);
+    writeValueArray(&vm.globalNames, OBJ_VAL(name));
+    tableSet(&vm.globalSlots, name, NUMBER_VAL((double)index));
+    pop();
+    return index;
+}
+
 // pushes a value onto the stack
 void push (Value value) {
     *vm.stackTop = value;
@@ -103,6 +163,53 @@ Value pop () {
 
 static Value peek    (int distance) { return vm.stackTop[-1 - distance]; } // added in ch18... peeks at the nth value from the top of the stack
 
+// slots kept free above a frame's deepest point for the temporaries runtime helpers push to root objects
+#define STACK_HEADROOM 8
+
+// grows the stack to hold at least needed slots, moving every pointer into it if realloc relocates it. the
+// old block may be gone once realloc returns, so the pointers are turned into offsets before and rebuilt after
+static bool growStack (int needed) {
+    if (needed > vm.stackMax) return false;
+
+    int capacity = vm.stackCapacity;
+    while (capacity < needed) capacity *= 2;
+    if (capacity > vm.stackMax) capacity = vm.stackMax;
+
+    size_t top = vm.stackTop - vm.stack;
+    for (int i = 0; i < vm.frameCount; i++) {
+        vm.frames[i].slots = (Value*)(uintptr_t)(vm.frames[i].slots - vm.stack);
+    }
+    for (ObjUpvalue* upvalue = vm.openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+        upvalue->location = (Value*)(uintptr_t)(upvalue->location - vm.stack);
+    }
+
+    vm.stack = (Value*)realloc(vm.stack, sizeof(Value) * capacity);
+    if (vm.stack == NULL) exit(1);
+    vm.stackCapacity = capacity;
+
+    vm.stackTop = vm.stack + top;
+    for (int i = 0; i < vm.frameCount; i++) {
+        vm.frames[i].slots = vm.stack + (uintptr_t)vm.frames[i].slots;
+    }
+    for (ObjUpvalue* upvalue = vm.openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+        upvalue->location = vm.stack + (uintptr_t)upvalue->location;
+    }
+    return true;
+}
+
+// doubles the frame array, up to vm.framesMax
+static bool growFrames () {
+    if (vm.frameCapacity == vm.framesMax) return false;
+
+    int capacity = vm.frameCapacity * 2;
+    if (capacity > vm.framesMax) capacity = vm.framesMax;
+
+    vm.frames = (CallFrame*)realloc(vm.frames, sizeof(CallFrame) * capacity);
+    if (vm.frames == NULL) exit(1);
+    vm.frameCapacity = capacity;
+    return true;
+}
+
 // static bool call (ObjFunction* function, int argCount) { // added in ch24
 static bool call (ObjClosure* closure, int argCount) { // modified in ch25...  calls a function
     // if (argCount != function->arity) {
@@ -112,14 +219,26 @@ static bool call (ObjClosure* closure, int argCount) { // modified in ch25...  c
         return false;
     }
 
-    if (vm.frameCount == FRAMES_MAX) {
+    // if (vm.frameCount == FRAMES_MAX) {
+    if (vm.frameCount == vm.frameCapacity && !growFrames()) {
+        runtimeError("Stack overflow.");
+        return false;
+    }
+
+    // everything run() holds into the stack is reloaded from the frames after a call, so it may move here
+    int needed = (int)(vm.stackTop - vm.stack) - argCount - 1 + closure->function->maxSlots + STACK_HEADROOM;
+    if (needed > vm.stackCapacity && !growStack(needed)) {
         runtimeError("Stack overflow.");
         return false;
     }
 
     CallFrame* frame = &vm.frames[vm.frameCount++];
-    frame->closure = closure;                  // added in ch25
-    frame->ip = closure->function->chunk.code; // added in ch25
+    frame->closure      = closure;               // added in ch25
+    frame->code         = closure->function->chunk.code;
+    frame->constants    = closure->function->chunk.constants.values;
+    frame->caches       = closure->function->chunk.caches;
+    frame->invokeCaches = closure->function->chunk.invokeCaches;
+    frame->ip           = frame->code;           // added in ch25
 
     // frame->function = function;
     // frame->ip = function->chunk.code;
@@ -174,18 +293,94 @@ static bool callValue (Value callee, int argCount) { // added in ch24
     return false;
 }
 
+// makes the checks callValue() would on a tail call's callee while the calling frame is still there, so an
+// error reports the call where it happened, and grows the stack for a callee whose frame will start at base
+static bool checkTailCall (Value callee, int argCount, Value* base) {
+    ObjClosure* closure = NULL;
+    if (IS_BOUND_METHOD(callee)) closure = AS_BOUND_METHOD(callee)->method;
+    else if (IS_CLOSURE(callee)) closure = AS_CLOSURE(callee);
+    else if (IS_CLASS(callee)) {
+        Value initializer;
+        if (tableGet(&AS_CLASS(callee)->methods, vm.initString, &initializer)) closure = AS_CLOSURE(initializer);
+        else if (argCount != 0) {
+            runtimeError("Expected 0 arguments but got %d.", argCount);
+            return false;
+        }
+    }
+    else if (!IS_NATIVE(callee)) {
+        runtimeError("Can only call functions and classes.");
+        return false;
+    }
+    if (closure == NULL) return true;
+
+    if (argCount != closure->function->arity) {
+        runtimeError("Expected %d arguments but got %d.", closure->function->arity, argCount);
+        return false;
+    }
+
+    int needed = (int)(base - vm.stack) + closure->function->maxSlots + STACK_HEADROOM;
+    if (needed > vm.stackCapacity && !growStack(needed)) {
+        runtimeError("Stack overflow.");
+        return false;
+    }
+    return true;
+}
+
 // invokes a method from a class
-static bool invokeFromClass (ObjClass* klass, ObjString* name, int argCount) { // added in ch28
+#ifdef DEBUG_LOG_CACHE
+    #define CACHE_STAT(counter) (vm.counter++)
+#else
+    #define CACHE_STAT(counter) ((void)0)
+#endif
+
+// a site that keeps seeing new shapes stops refilling its cache and just does the table lookups
+#define CACHE_MISS_LIMIT 8
+
+// returns the method an invoke site cached for key, or NULL if it has none
+static ObjClosure* lookupInvokeCache (InvokeCache* cache, Obj* key) {
+    for (int i = 0; i < cache->count; i++) {
+        if (cache->keys[i] == key) {
+            CACHE_STAT(cacheHits);
+            return AS_CLOSURE(cache->methods[i]);
+        }
+    }
+    return NULL;
+}
+
+// remembers the method an invoke site resolved for key, once the site has room for it
+static void fillInvokeCache (InvokeCache* cache, Obj* key, Value method) {
+    if (cache->count == INVOKE_CACHE_SIZE) {
+        CACHE_STAT(cacheMegamorphic);
+        return;
+    }
+
+    CACHE_STAT(cacheMisses);
+    cache->keys[cache->count]    = key;
+    cache->methods[cache->count] = method;
+    cache->count++;
+
+    Obj* function = (Obj*)vm.frames[vm.frameCount - 1].closure->function; // the cache's owner
+    writeBarrier(function, key);
+    writeBarrierValue(function, method);
+}
+
+// invokes a method from a class, caching it in the call site under key
+// static bool invokeFromClass (ObjClass* klass, ObjString* name, int argCount) { // added in ch28
+static bool invokeFromClass (ObjClass* klass, ObjString* name, int argCount, InvokeCache* cache, Obj* key) {
     Value method;
     if (!tableGet(&klass->methods, name, &method)) {
         runtimeError("Undefined property '%s'.", name->chars);
         return false;
     }
+
+    fillInvokeCache(cache, key, method);
     return call(AS_CLOSURE(method), argCount);
 }
 
-// invokes a method
-static bool invoke (ObjString* name, int argCount) { // added in ch28
+// invokes a method; the receiver's shape keys the cache, so an instance whose field shadows the method
+// never shares an entry with one that doesn't
+// static bool invoke (ObjString* name, int argCount) { // added in ch28
+static bool invoke (ObjString* name, int argCount, InvokeCache* cache) {
     Value receiver = peek(argCount);
 
     if (!IS_INSTANCE(receiver)) {
@@ -194,14 +389,16 @@ static bool invoke (ObjString* name, int argCount) { // added in ch28
     }
 
     ObjInstance* instance = AS_INSTANCE(receiver);
-    Value value;
+    ObjClosure*  method   = lookupInvokeCache(cache, (Obj*)instance->shape);
+    if (method != NULL) return call(method, argCount);
 
-    if (tableGet(&instance->fields, name, &value)) {
+    Value value;
+    if (getField(instance, name, &value)) {
         vm.stackTop[-argCount - 1] = value;
         return callValue(value, argCount);
     }
 
-    return invokeFromClass(instance->klass, name, argCount);
+    return invokeFromClass(instance->klass, name, argCount, cache, (Obj*)instance->shape);
 }
 
 // binds a method to a class
@@ -218,6 +415,50 @@ static bool bindMethod (ObjClass* klass, ObjString* name) { // added in ch28
     return true;
 }
 
+// records what a property lookup resolved to in the cache of the instruction that did it
+static void fillCache (PropertyCache* cache, ObjShape* shape, ObjShape* transition, int slot, Value method) {
+    if (cache->misses >= CACHE_MISS_LIMIT) {
+        CACHE_STAT(cacheMegamorphic);
+        return;
+    }
+
+    CACHE_STAT(cacheMisses);
+    if (cache->shape != NULL) cache->misses++;
+    cache->shape      = shape;
+    cache->transition = transition;
+    cache->slot       = slot;
+    cache->method     = method;
+
+    Obj* function = (Obj*)vm.frames[vm.frameCount - 1].closure->function; // the cache's owner
+    writeBarrier(function, (Obj*)shape);
+    writeBarrier(function, (Obj*)transition);
+    writeBarrierValue(function, method);
+}
+
+// looks up a property the inline cache missed on and replaces the instance on top of the stack with it
+static bool getPropertyUncached (ObjInstance* instance, ObjString* name, PropertyCache* cache) {
+    Value slot;
+    if (tableGet(&instance->shape->slots, name, &slot)) {
+        fillCache(cache, instance->shape, NULL, (int)AS_NUMBER(slot), NIL_VAL);
+        vm.stackTop[-1] = instance->fields[(int)AS_NUMBER(slot)];
+        return true;
+    }
+
+    Value method;
+    if (tableGet(&instance->klass->methods, name, &method)) fillCache(cache, instance->shape, NULL, -1, method);
+    return bindMethod(instance->klass, name);
+}
+
+// stores a property the inline cache missed on, remembering the slot or the shape transition it took
+static void setPropertyUncached (ObjInstance* instance, ObjString* name, Value value, PropertyCache* cache) {
+    ObjShape* shape = instance->shape;
+    setField(instance, name, value);
+
+    Value slot;
+    tableGet(&instance->shape->slots, name, &slot);
+    fillCache(cache, shape, shape == instance->shape ? NULL : instance->shape, (int)AS_NUMBER(slot), NIL_VAL);
+}
+
 // captures an upvalue
 static ObjUpvalue* captureUpvalue (Value* local) {  // added in ch25
     ObjUpvalue* prevUpvalue = NULL;
@@ -245,6 +486,7 @@ static void closeUpvalues (Value* last) { // added in ch25
         ObjUpvalue* upvalue = vm.openUpvalues;
         upvalue->closed = *upvalue->location;
         upvalue->location = &upvalue->closed;
+        writeBarrierValue((Obj*)upvalue, upvalue->closed);
         vm.openUpvalues = upvalue->next;
     }
 }
@@ -278,27 +520,156 @@ static void concatenate () { // added in ch19
     push(OBJ_VAL(result));
 }
 
+#ifdef DEBUG_TRACE_EXECUTION
+// prints the stack and the instruction about to execute
+static void traceExecution (CallFrame* frame) {
+    printf("          ");
+    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+        printf("[ ");
+        printValue(*slot);
+        printf(" ]");
+    }
+
+    printf("\n");
+    disassembleInstruction(&frame->closure->function->chunk, (int)(frame->ip - frame->code)); // added in ch25
+    // disassembleInstruction(&frame->function->chunk, (int)(frame->ip - frame->function->chunk.code)); // added in ch24
+    // disassembleInstruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
+}
+#endif
+
 // runs the VM
 static InterpretResult run () {
     // #define READ_BYTE() (*vm.ip++)
     // #define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
     // #define READ_SHORT() (vm.ip += 2, (uint16_t)((vm.ip[-2] << 8) | vm.ip[-1])) // added in ch23
 
-    CallFrame* frame = &vm.frames[vm.frameCount - 1];                                       // added in ch24
-    #define READ_BYTE() (*frame->ip++)                                                      // added in ch24
-    #define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1])) // added in ch24
-    // #define READ_CONSTANT() (frame->function->chunk.constants.values[READ_BYTE()])       // added in ch24
-    #define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()]) // modified in ch25
+    // the hot interpreter state lives in locals so the compiler can keep it in machine registers. it is
+    // written back to the frame and vm.stackTop only at sync points: calls, returns, anything that can
+    // allocate (and so run the GC, which scans vm.stack up to vm.stackTop) and runtime errors
+    CallFrame* frame;     // added in ch24
+    uint8_t*   ip;
+    Value*     slots;
+    Value*     constants;
+    Value*     sp;
+
+    #define STORE_FRAME() (frame->ip = ip, vm.stackTop = sp)
+    #define LOAD_FRAME() \
+        do { \
+            frame     = &vm.frames[vm.frameCount - 1]; \
+            ip        = frame->ip; \
+            slots     = frame->slots; \
+            constants = frame->constants; \
+            sp        = vm.stackTop; \
+        } while (false)
+
+    #define PUSH(value)   (*sp++ = (value))
+    #define POP()         (*--sp)
+    #define PEEK(distance) (sp[-1 - (distance)])
+    #define DROP(count)   (sp -= (count))
+
+    #define RUNTIME_ERROR(...) \
+        do { \
+            STORE_FRAME(); \
+            runtimeError(__VA_ARGS__); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } while (false)
+
+    // #define READ_BYTE() (*frame->ip++)                                                   // added in ch24
+    // #define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1])) // added in ch24
+    // #define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()]) // modified in ch25
+    #define READ_BYTE() (*ip++)
+    #define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+    #define READ_CONSTANT() (constants[READ_BYTE()])
     #define READ_STRING() AS_STRING(READ_CONSTANT()) // added in ch21
+    #define READ_LONG() (ip += 3, readLongOperand(ip - 3))
+    // the operand of an instruction sharing its handler with a wide form, whichever one is running
+    #define READ_CONSTANT_OPERAND(longOp) (instruction == longOp ? constants[READ_LONG()] : READ_CONSTANT())
     #define BINARY_OP(valueType, op) \
         do { \
-            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-                runtimeError("Operands must be numbers."); \
-                return INTERPRET_RUNTIME_ERROR; \
+            if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+                RUNTIME_ERROR("Operands must be numbers."); \
             } \
-            double b = AS_NUMBER(pop()); \
-            double a = AS_NUMBER(pop()); \
-            push(valueType(a op b)); \
+            double b = AS_NUMBER(POP()); \
+            double a = AS_NUMBER(POP()); \
+            PUSH(valueType(a op b)); \
+        } while (false)
+
+    // register forms read both operands straight out of frame slots (or the constant table) and write the
+    // result to slot dst without touching the stack
+    #define REGISTER_OP(op, readB) \
+        do { \
+            uint8_t dst = READ_BYTE(); \
+            Value   a   = slots[READ_BYTE()]; \
+            Value   b   = readB; \
+            if (!IS_NUMBER(a) || !IS_NUMBER(b)) { \
+                RUNTIME_ERROR("Operands must be numbers."); \
+            } \
+            slots[dst] = NUMBER_VAL(AS_NUMBER(a) op AS_NUMBER(b)); \
+        } while (false)
+    // quickening: a generic arithmetic or comparison op that just saw two numbers rewrites itself in the chunk
+    // into its number-only form, which only guards the operand types; when the guard fails the op rewrites
+    // itself back and re-dispatches, so the generic handler deals with strings and reports the errors
+    #define QUICKEN(quickOp) (ip[-1] = (quickOp))
+    #define NUMBER_OP(valueType, op, genericOp) \
+        if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+            *--ip = (genericOp); \
+        } \
+        else { \
+            double b = AS_NUMBER(POP()); \
+            double a = AS_NUMBER(POP()); \
+            PUSH(valueType(a op b)); \
+        }
+
+    // pushes a + b for operands read straight from slots or constants, concatenating strings
+    #define PUSH_SUM(a, b) \
+        do { \
+            if (IS_NUMBER(a) && IS_NUMBER(b)) { \
+                PUSH(NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b))); \
+            } \
+            else if (IS_STRING(a) && IS_STRING(b)) { \
+                PUSH(a); \
+                PUSH(b); \
+                STORE_FRAME(); \
+                concatenate(); \
+                sp = vm.stackTop; \
+            } \
+            else { RUNTIME_ERROR("Operands must be two numbers or two strings."); } \
+        } while (false)
+    // pops two numbers and jumps when (a op b) comes out as taken
+    #define COMPARE_JUMP(op, taken, readDistance) \
+        do { \
+            uint32_t distance = readDistance; \
+            if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+                RUNTIME_ERROR("Operands must be numbers."); \
+            } \
+            double b = AS_NUMBER(POP()); \
+            double a = AS_NUMBER(POP()); \
+            if ((a op b) == taken) ip += distance; \
+        } while (false)
+    #define EQUAL_JUMP(taken, readDistance) \
+        do { \
+            uint32_t distance = readDistance; \
+            Value b = POP(); \
+            Value a = POP(); \
+            if (valuesEqual(a, b) == taken) ip += distance; \
+        } while (false)
+    #define REGISTER_ADD(readB) \
+        do { \
+            uint8_t dst = READ_BYTE(); \
+            Value   a   = slots[READ_BYTE()]; \
+            Value   b   = readB; \
+            if (IS_NUMBER(a) && IS_NUMBER(b)) { \
+                slots[dst] = NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)); \
+            } \
+            else if (IS_STRING(a) && IS_STRING(b)) { \
+                PUSH(a); \
+                PUSH(b); \
+                STORE_FRAME(); \
+                concatenate(); \
+                sp = vm.stackTop; \
+                slots[dst] = POP(); \
+            } \
+            else { RUNTIME_ERROR("Operands must be two numbers or two strings."); } \
         } while (false)
 
     // #define BINARY_OP(op) \
@@ -308,172 +679,291 @@ static InterpretResult run () {
     //         push(a op b); \
     //     } while (false)
 
+    #ifdef DEBUG_TRACE_EXECUTION
+        #define TRACE_EXECUTION() do { STORE_FRAME(); traceExecution(frame); } while (false)
+    #else
+        #define TRACE_EXECUTION() do { } while (false)
+    #endif
+
+    // threaded dispatch: every handler ends in its own indirect jump through the label table, so the
+    // branch predictor sees one dispatch site per opcode instead of the single switch at the top of the loop
+    #ifdef COMPUTED_GOTO
+        static void* dispatchTable[] = {
+            [OP_CONSTANT]      = &&TARGET_OP_CONSTANT,
+            [OP_NIL]           = &&TARGET_OP_NIL,
+            [OP_TRUE]          = &&TARGET_OP_TRUE,
+            [OP_FALSE]         = &&TARGET_OP_FALSE,
+            [OP_POP]           = &&TARGET_OP_POP,
+            [OP_GET_LOCAL]     = &&TARGET_OP_GET_LOCAL,
+            [OP_SET_LOCAL]     = &&TARGET_OP_SET_LOCAL,
+            [OP_GET_GLOBAL]    = &&TARGET_OP_GET_GLOBAL,
+            [OP_DEFINE_GLOBAL] = &&TARGET_OP_DEFINE_GLOBAL,
+            [OP_SET_GLOBAL]    = &&TARGET_OP_SET_GLOBAL,
+            [OP_GET_UPVALUE]   = &&TARGET_OP_GET_UPVALUE,
+            [OP_SET_UPVALUE]   = &&TARGET_OP_SET_UPVALUE,
+            [OP_GET_PROPERTY]  = &&TARGET_OP_GET_PROPERTY,
+            [OP_SET_PROPERTY]  = &&TARGET_OP_SET_PROPERTY,
+            [OP_GET_SUPER]     = &&TARGET_OP_GET_SUPER,
+            [OP_EQUAL]         = &&TARGET_OP_EQUAL,
+            [OP_GREATER]       = &&TARGET_OP_GREATER,
+            [OP_LESS]          = &&TARGET_OP_LESS,
+            [OP_ADD]           = &&TARGET_OP_ADD,
+            [OP_SUBTRACT]      = &&TARGET_OP_SUBTRACT,
+            [OP_MULTIPLY]      = &&TARGET_OP_MULTIPLY,
+            [OP_DIVIDE]        = &&TARGET_OP_DIVIDE,
+            [OP_NOT]           = &&TARGET_OP_NOT,
+            [OP_NEGATE]        = &&TARGET_OP_NEGATE,
+            [OP_PRINT]         = &&TARGET_OP_PRINT,
+            [OP_JUMP]          = &&TARGET_OP_JUMP,
+            [OP_JUMP_IF_FALSE] = &&TARGET_OP_JUMP_IF_FALSE,
+            [OP_LOOP]          = &&TARGET_OP_LOOP,
+            [OP_CALL]          = &&TARGET_OP_CALL,
+            [OP_CLOSURE]       = &&TARGET_OP_CLOSURE,
+            [OP_INVOKE]        = &&TARGET_OP_INVOKE,
+            [OP_SUPER_INVOKE]  = &&TARGET_OP_SUPER_INVOKE,
+            [OP_CLOSE_UPVALUE] = &&TARGET_OP_CLOSE_UPVALUE,
+            [OP_RETURN]        = &&TARGET_OP_RETURN,
+            [OP_CLASS]         = &&TARGET_OP_CLASS,
+            [OP_INHERIT]       = &&TARGET_OP_INHERIT,
+            [OP_METHOD]        = &&TARGET_OP_METHOD,
+            [OP_REG_MOVE]              = &&TARGET_OP_REG_MOVE,
+            [OP_REG_LOAD_CONSTANT]     = &&TARGET_OP_REG_LOAD_CONSTANT,
+            [OP_REG_ADD]               = &&TARGET_OP_REG_ADD,
+            [OP_REG_SUBTRACT]          = &&TARGET_OP_REG_SUBTRACT,
+            [OP_REG_MULTIPLY]          = &&TARGET_OP_REG_MULTIPLY,
+            [OP_REG_DIVIDE]            = &&TARGET_OP_REG_DIVIDE,
+            [OP_REG_ADD_CONSTANT]      = &&TARGET_OP_REG_ADD_CONSTANT,
+            [OP_REG_SUBTRACT_CONSTANT] = &&TARGET_OP_REG_SUBTRACT_CONSTANT,
+            [OP_REG_MULTIPLY_CONSTANT] = &&TARGET_OP_REG_MULTIPLY_CONSTANT,
+            [OP_REG_DIVIDE_CONSTANT]   = &&TARGET_OP_REG_DIVIDE_CONSTANT,
+            [OP_ADD_LOCALS]              = &&TARGET_OP_ADD_LOCALS,
+            [OP_ADD_LOCAL_CONSTANT]      = &&TARGET_OP_ADD_LOCAL_CONSTANT,
+            [OP_SUBTRACT_LOCAL_CONSTANT] = &&TARGET_OP_SUBTRACT_LOCAL_CONSTANT,
+            [OP_SET_LOCAL_POP]           = &&TARGET_OP_SET_LOCAL_POP,
+            [OP_GET_THIS_PROPERTY]       = &&TARGET_OP_GET_THIS_PROPERTY,
+            [OP_POPN]                    = &&TARGET_OP_POPN,
+            [OP_POP_JUMP_IF_FALSE]    = &&TARGET_OP_POP_JUMP_IF_FALSE,
+            [OP_POP_JUMP_IF_TRUE]     = &&TARGET_OP_POP_JUMP_IF_TRUE,
+            [OP_JUMP_IF_FALSE_OR_POP] = &&TARGET_OP_JUMP_IF_FALSE_OR_POP,
+            [OP_JUMP_IF_TRUE_OR_POP]  = &&TARGET_OP_JUMP_IF_TRUE_OR_POP,
+            [OP_JUMP_IF_NOT_LESS]     = &&TARGET_OP_JUMP_IF_NOT_LESS,
+            [OP_JUMP_IF_LESS]         = &&TARGET_OP_JUMP_IF_LESS,
+            [OP_JUMP_IF_NOT_GREATER]  = &&TARGET_OP_JUMP_IF_NOT_GREATER,
+            [OP_JUMP_IF_GREATER]      = &&TARGET_OP_JUMP_IF_GREATER,
+            [OP_JUMP_IF_NOT_EQUAL]    = &&TARGET_OP_JUMP_IF_NOT_EQUAL,
+            [OP_JUMP_IF_EQUAL]        = &&TARGET_OP_JUMP_IF_EQUAL,
+            [OP_ADD_NUMBER]      = &&TARGET_OP_ADD_NUMBER,
+            [OP_SUBTRACT_NUMBER] = &&TARGET_OP_SUBTRACT_NUMBER,
+            [OP_LESS_NUMBER]     = &&TARGET_OP_LESS_NUMBER,
+            [OP_GREATER_NUMBER]  = &&TARGET_OP_GREATER_NUMBER,
+            [OP_TAIL_CALL]       = &&TARGET_OP_TAIL_CALL,
+            [OP_CONSTANT_LONG]    = &&TARGET_OP_CONSTANT_LONG,
+            [OP_GET_LOCAL_LONG]   = &&TARGET_OP_GET_LOCAL_LONG,
+            [OP_SET_LOCAL_LONG]   = &&TARGET_OP_SET_LOCAL_LONG,
+            [OP_GET_UPVALUE_LONG] = &&TARGET_OP_GET_UPVALUE_LONG,
+            [OP_SET_UPVALUE_LONG] = &&TARGET_OP_SET_UPVALUE_LONG,
+            [OP_CLOSURE_LONG]     = &&TARGET_OP_CLOSURE_LONG,
+            [OP_CLASS_LONG]       = &&TARGET_OP_CLASS_LONG,
+            [OP_METHOD_LONG]      = &&TARGET_OP_METHOD_LONG,
+            [OP_GET_SUPER_LONG]   = &&TARGET_OP_GET_SUPER_LONG,
+            [OP_LONG_JUMP]        = &&TARGET_OP_LONG_JUMP
+        };
+
+        #define CASE(op)   TARGET_##op
+        #define DISPATCH() do { TRACE_EXECUTION(); goto *dispatchTable[instruction = READ_BYTE()]; } while (false)
+    #else
+        #define CASE(op)   case op
+        #define DISPATCH() break
+    #endif
+
+    uint8_t instruction;
+    LOAD_FRAME();
+
+    #ifdef COMPUTED_GOTO
+        DISPATCH();
+    #else
     while (1) {
-        #ifdef DEBUG_TRACE_EXECUTION
-            // print stack contents
-            printf("          ");
-            for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
-                printf("[ ");
-                printValue(*slot);
-                printf(" ]");
-            }   
-
-            printf("\n");
-            disassembleInstruction(&frame->closure->function->chunk, (int)(frame->ip - frame->closure->function->chunk.code)); // added in ch25
-            // disassembleInstruction(&frame->function->chunk, (int)(frame->ip - frame->function->chunk.code)); // added in ch24
-            // disassembleInstruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
-        #endif
-
-        uint8_t instruction;
-        
+        TRACE_EXECUTION();
+
         switch (instruction = READ_BYTE()) {
-            case OP_CONSTANT: {
+    #endif
+            CASE(OP_CONSTANT): {
                 Value constant  = READ_CONSTANT();
                 // printValue(constant);
                 // // printf("\n");
                 // std::cout << "\n";
-                push(constant);
-                break;
+                PUSH(constant);
+                DISPATCH();
             }
 
-            case OP_NIL: push(NIL_VAL);           break;       // added in ch18
-            case OP_TRUE: push(BOOL_VAL(true));   break;       // added in ch18 
-            case OP_FALSE: push(BOOL_VAL(false)); break;       // added in ch18
-            case OP_POP: pop();                   break;       // added in ch21
+            CASE(OP_NIL):   PUSH(NIL_VAL);         DISPATCH(); // added in ch18
+            CASE(OP_TRUE):  PUSH(BOOL_VAL(true));  DISPATCH(); // added in ch18
+            CASE(OP_FALSE): PUSH(BOOL_VAL(false)); DISPATCH(); // added in ch18
+            CASE(OP_POP):   DROP(1);               DISPATCH(); // added in ch21
 
-            case OP_GET_LOCAL: {                               // added in ch22
+            CASE(OP_GET_LOCAL): {                               // added in ch22
                 uint8_t slot = READ_BYTE();
-                push(frame->slots[slot]);                      // added in ch24
+                PUSH(slots[slot]);                              // added in ch24
                 // push(vm.stack[slot]); 
-                break;
+                DISPATCH();
             }
 
-            case OP_SET_LOCAL: {                               // added in ch22
+            CASE(OP_SET_LOCAL): {                               // added in ch22
                 uint8_t slot = READ_BYTE();
-                frame->slots[slot] = peek(0);                  // added in ch24
+                slots[slot] = PEEK(0);                          // added in ch24
                 // vm.stack[slot] = peek(0);
-                break;
+                DISPATCH();
             }
 
-            case OP_GET_GLOBAL: {                              // added in ch21
-                ObjString* name = READ_STRING();
-                Value value;
-                if (!tableGet(&vm.globals, name, &value)) {
-                    runtimeError("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                push(value);
-                break;
+            CASE(OP_GET_GLOBAL): {                              // added in ch21
+                uint16_t slot  = READ_SHORT();
+                Value    value = vm.globalValues.values[slot];
+                if (IS_UNDEFINED(value)) { RUNTIME_ERROR("Undefined variable '%s'.", AS_CSTRING(vm.globalNames.values[slot])); }
+                PUSH(value);
+                DISPATCH();
             }
 
-            case OP_DEFINE_GLOBAL: {                           // added in ch21
-                ObjString* name = READ_STRING();
-                tableSet(&vm.globals, name, peek(0));
-                pop();
-                break;
+            CASE(OP_DEFINE_GLOBAL): {                           // added in ch21
+                vm.globalValues.values[READ_SHORT()] = POP();
+                DISPATCH();
             }
 
-            case OP_SET_GLOBAL: {                              // added in ch21
-                ObjString* name = READ_STRING();
-                if (tableSet(&vm.globals, name, peek(0))) {
-                    tableDelete(&vm.globals, name); 
-                    runtimeError("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
+            CASE(OP_SET_GLOBAL): {                              // added in ch21
+                uint16_t slot = READ_SHORT();
+                if (IS_UNDEFINED(vm.globalValues.values[slot])) {
+                    RUNTIME_ERROR("Undefined variable '%s'.", AS_CSTRING(vm.globalNames.values[slot]));
                 }
-                break;
+                vm.globalValues.values[slot] = PEEK(0);
+                DISPATCH();
             }
 
-            case OP_GET_PROPERTY: {                           // added in ch27
-                if (!IS_INSTANCE(peek(0))) {
-                    runtimeError("Only instances have properties.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+            CASE(OP_GET_PROPERTY): {                           // added in ch27
+                if (!IS_INSTANCE(PEEK(0))) { RUNTIME_ERROR("Only instances have properties."); }
+
+                ObjInstance*   instance = AS_INSTANCE(PEEK(0));
+                PropertyCache* cache    = &frame->caches[READ_SHORT()];
+                ObjString*     name     = cache->name;
 
-                ObjInstance* instance = AS_INSTANCE(peek(0));
-                ObjString*   name     = READ_STRING();
+                if (cache->shape == instance->shape) {
+                    CACHE_STAT(cacheHits);
+                    if (cache->slot >= 0) {
+                        PEEK(0) = instance->fields[cache->slot]; // replaces the instance
+                        DISPATCH();
+                    }
 
-                Value value;
-                if (tableGet(&instance->fields, name, &value)) {
-                    pop(); // Instance.
-                    push(value);
-                    break;
+                    STORE_FRAME();
+                    PEEK(0) = OBJ_VAL(newBoundMethod(PEEK(0), AS_CLOSURE(cache->method)));
+                    DISPATCH();
                 }
 
-                if (!bindMethod(instance->klass, name)) { return INTERPRET_RUNTIME_ERROR; } // added in ch28
-                break;                                                                      // added in ch28
+                STORE_FRAME();
+                if (!getPropertyUncached(instance, name, cache)) { return INTERPRET_RUNTIME_ERROR; }
+                DISPATCH();
+
+                // Value value;
+                // if (tableGet(&instance->fields, name, &value)) {
+                //     PEEK(0) = value; // replaces the instance
+                //     DISPATCH();
+                // }
+                // if (!bindMethod(instance->klass, name)) { return INTERPRET_RUNTIME_ERROR; } // added in ch28
 
                 // runtimeError("Undefined property '%s'.", name->chars);
                 // return INTERPRET_RUNTIME_ERROR;
             }
 
-            case OP_SET_PROPERTY: {                           // added in ch27
-                if (!IS_INSTANCE(peek(1))) {
-                    runtimeError("Only instances have fields.");
-                    return INTERPRET_RUNTIME_ERROR;
+            CASE(OP_SET_PROPERTY): {                           // added in ch27
+                if (!IS_INSTANCE(PEEK(1))) { RUNTIME_ERROR("Only instances have fields."); }
+
+                ObjInstance*   instance = AS_INSTANCE(PEEK(1));
+                PropertyCache* cache    = &frame->caches[READ_SHORT()];
+                ObjString*     name     = cache->name;
+
+                if (cache->shape == instance->shape && cache->transition == NULL) {
+                    CACHE_STAT(cacheHits);
+                    instance->fields[cache->slot] = PEEK(0);
+                    writeBarrierValue((Obj*)instance, PEEK(0));
+                }
+                else if (cache->shape == instance->shape) {
+                    CACHE_STAT(cacheHits);
+                    STORE_FRAME();
+                    addField(instance, cache->transition, PEEK(0));
+                }
+                else {
+                    STORE_FRAME();
+                    setPropertyUncached(instance, name, PEEK(0), cache);
                 }
 
-                ObjInstance* instance = AS_INSTANCE(peek(1));
-                tableSet(&instance->fields, READ_STRING(), peek(0));
-                Value value = pop();
-                pop();
-                push(value);
-                break;
+                Value value = POP();
+                PEEK(0) = value; // replaces the instance
+                DISPATCH();
             }
 
-            case OP_GET_SUPER: {                              // added in ch29
-                ObjString* name = READ_STRING();
-                ObjClass* superclass = AS_CLASS(pop());
+            CASE(OP_GET_SUPER):                                // added in ch29
+            CASE(OP_GET_SUPER_LONG): {
+                // ObjString* name = READ_STRING();
+                ObjString* name = AS_STRING(READ_CONSTANT_OPERAND(OP_GET_SUPER_LONG));
+                ObjClass* superclass = AS_CLASS(POP());
 
+                STORE_FRAME();
                 if (!bindMethod(superclass, name)) { return INTERPRET_RUNTIME_ERROR; }
-                break;
+                DISPATCH();
             }
 
-            case OP_EQUAL: {                                   // added in ch18
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(valuesEqual(a, b)));
-                break;
+            CASE(OP_EQUAL): {                                   // added in ch18
+                Value b = POP();
+                Value a = POP();
+                PUSH(BOOL_VAL(valuesEqual(a, b)));
+                DISPATCH();
             }
 
-            case OP_GET_UPVALUE: {                            // added in ch25
+            CASE(OP_GET_UPVALUE): {                            // added in ch25
                 uint8_t slot = READ_BYTE();
-                push(*frame->closure->upvalues[slot]->location);
-                break;
+                PUSH(*frame->closure->upvalues[slot]->location);
+                DISPATCH();
             }
 
-            case OP_SET_UPVALUE: {                            // added in ch25
+            CASE(OP_SET_UPVALUE): {                            // added in ch25
                 uint8_t slot = READ_BYTE();
-                *frame->closure->upvalues[slot]->location = peek(0);
-                break;
+                *frame->closure->upvalues[slot]->location = PEEK(0);
+                writeBarrierValue((Obj*)frame->closure->upvalues[slot], PEEK(0)); // only matters once it's closed
+                DISPATCH();
             }
 
-            case OP_GREATER:  BINARY_OP(BOOL_VAL, >);   break; // added in ch18
-            case OP_LESS:     BINARY_OP(BOOL_VAL, <);   break; // added in ch18
+            // CASE(OP_GREATER):  BINARY_OP(BOOL_VAL, >);   DISPATCH(); // added in ch18
+            // CASE(OP_LESS):     BINARY_OP(BOOL_VAL, <);   DISPATCH(); // added in ch18
+            CASE(OP_GREATER):  BINARY_OP(BOOL_VAL, >);   QUICKEN(OP_GREATER_NUMBER); DISPATCH();
+            CASE(OP_LESS):     BINARY_OP(BOOL_VAL, <);   QUICKEN(OP_LESS_NUMBER);    DISPATCH();
 
             // case OP_ADD:      BINARY_OP(NUMBER_VAL, +); break; // updated in ch18
-            case OP_ADD: { // updated in ch19
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+            CASE(OP_ADD): { // updated in ch19
+                if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1))) {
+                    STORE_FRAME();
                     concatenate();
+                    sp = vm.stackTop;
                 } 
-                else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-                    double b = AS_NUMBER(pop());
-                    double a = AS_NUMBER(pop());
-                    push(NUMBER_VAL(a + b));
-                }
-                else {
-                    runtimeError("Operands must be two numbers or two strings.");
-                    return INTERPRET_RUNTIME_ERROR;
+                else if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {
+                    double b = AS_NUMBER(POP());
+                    double a = AS_NUMBER(POP());
+                    PUSH(NUMBER_VAL(a + b));
+                    QUICKEN(OP_ADD_NUMBER);
                 }
-                break;
+                else { RUNTIME_ERROR("Operands must be two numbers or two strings."); }
+                DISPATCH();
             }
 
-            case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -); break; // updated in ch18
-            case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break; // updated in ch18
-            case OP_DIVIDE:   BINARY_OP(NUMBER_VAL, /); break; // updated in ch18
+            // CASE(OP_SUBTRACT): BINARY_OP(NUMBER_VAL, -); DISPATCH(); // updated in ch18
+            CASE(OP_SUBTRACT): BINARY_OP(NUMBER_VAL, -); QUICKEN(OP_SUBTRACT_NUMBER); DISPATCH();
+            CASE(OP_MULTIPLY): BINARY_OP(NUMBER_VAL, *); DISPATCH(); // updated in ch18
+            CASE(OP_DIVIDE):   BINARY_OP(NUMBER_VAL, /); DISPATCH(); // updated in ch18
+
+            CASE(OP_ADD_NUMBER):      NUMBER_OP(NUMBER_VAL, +, OP_ADD);      DISPATCH();
+            CASE(OP_SUBTRACT_NUMBER): NUMBER_OP(NUMBER_VAL, -, OP_SUBTRACT); DISPATCH();
+            CASE(OP_LESS_NUMBER):     NUMBER_OP(BOOL_VAL, <, OP_LESS);       DISPATCH();
+            CASE(OP_GREATER_NUMBER):  NUMBER_OP(BOOL_VAL, >, OP_GREATER);    DISPATCH();
 
-            case OP_NOT: // added in ch18
-                push(BOOL_VAL(isFalsey(pop())));
-                break;
+            CASE(OP_NOT): // added in ch18
+                PEEK(0) = BOOL_VAL(isFalsey(PEEK(0)));
+                DISPATCH();
 
             // case OP_ADD: {
             //     BINARY_OP(+);
@@ -495,140 +985,371 @@ static InterpretResult run () {
             //     break;
             // }
  
-            case OP_NEGATE: // updated in ch18
-                if (!IS_NUMBER(peek(0))) {
-                    runtimeError("Operand must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                push(NUMBER_VAL(-AS_NUMBER(pop())));
-                break;
+            CASE(OP_NEGATE): // updated in ch18
+                if (!IS_NUMBER(PEEK(0))) { RUNTIME_ERROR("Operand must be a number."); }
+                PEEK(0) = NUMBER_VAL(-AS_NUMBER(PEEK(0)));
+                DISPATCH();
 
             // case OP_NEGATE: {
             //     push(-pop());
             //     break;
             // }
  
-            case OP_PRINT: { // added in ch21
-                printValue(pop());
+            CASE(OP_PRINT): { // added in ch21
+                printValue(POP());
                 printf("\n"); 
-                break;
+                DISPATCH();
             }
 
-            case OP_JUMP: { // added in ch23
+            CASE(OP_JUMP): { // added in ch23
                 uint16_t offset = READ_SHORT();
-                frame->ip += offset;  // added in ch24  
+                ip += offset;  // added in ch24  
                 // vm.ip += offset;
-                break;
+                DISPATCH();
             }
 
-            case OP_JUMP_IF_FALSE: { // added in ch23
+            CASE(OP_JUMP_IF_FALSE): { // added in ch23
                 uint16_t offset = READ_SHORT();
-                if (isFalsey(peek(0))) frame->ip += offset; // added in ch24
+                if (isFalsey(PEEK(0))) ip += offset; // added in ch24
                 // if (isFalsey(peek(0))) vm.ip += offset;
-                break;
+                DISPATCH();
             }
 
-            case OP_LOOP: { // added in ch23
+            CASE(OP_LOOP): { // added in ch23
                 uint16_t offset = READ_SHORT();
-                frame->ip -= offset; // added in ch24
+                ip -= offset; // added in ch24
                 // vm.ip -= offset;
-                break;
+                DISPATCH();
             }
 
-            case OP_CALL: { // added in ch24
+            CASE(OP_CALL): { // added in ch24
                 int argCount = READ_BYTE();
-                if (!callValue(peek(argCount), argCount)) return INTERPRET_RUNTIME_ERROR; 
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+                STORE_FRAME();
+                if (!callValue(PEEK(argCount), argCount)) return INTERPRET_RUNTIME_ERROR; 
+                LOAD_FRAME();
+                DISPATCH();
             }
 
-            case OP_INVOKE: { // added in ch28
-                ObjString* method = READ_STRING();
+            CASE(OP_TAIL_CALL): {
                 int argCount = READ_BYTE();
-                if (!invoke(method, argCount)) { return INTERPRET_RUNTIME_ERROR; }
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+                STORE_FRAME();
+                if (!checkTailCall(PEEK(argCount), argCount, slots)) return INTERPRET_RUNTIME_ERROR;
+                LOAD_FRAME(); // the check may have moved the stack
+
+                // drop this frame first and slide the callee and its arguments down over it, so the call
+                // below pushes its frame where ours was (or, for a native, leaves the result as our return)
+                closeUpvalues(slots);
+                Value* callee = sp - argCount - 1;
+                for (int i = 0; i <= argCount; i++) slots[i] = callee[i];
+                sp = slots + argCount + 1;
+                vm.frameCount--;
+
+                STORE_FRAME();
+                if (!callValue(PEEK(argCount), argCount)) return INTERPRET_RUNTIME_ERROR;
+                LOAD_FRAME();
+                DISPATCH();
             }
 
-            case OP_SUPER_INVOKE: { // added in ch29
-                ObjString* method = READ_STRING();
-                int argCount = READ_BYTE();
-                ObjClass* superclass = AS_CLASS(pop());
-                if (!invokeFromClass(superclass, method, argCount)) { return INTERPRET_RUNTIME_ERROR; }
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+            CASE(OP_INVOKE): { // added in ch28
+                int          argCount = READ_BYTE();
+                InvokeCache* cache    = &frame->invokeCaches[READ_SHORT()];
+                STORE_FRAME();
+                if (!invoke(cache->name, argCount, cache)) { return INTERPRET_RUNTIME_ERROR; }
+                LOAD_FRAME();
+                DISPATCH();
+            }
+
+            CASE(OP_SUPER_INVOKE): { // added in ch29
+                int          argCount   = READ_BYTE();
+                InvokeCache* cache      = &frame->invokeCaches[READ_SHORT()];
+                ObjClass*    superclass = AS_CLASS(POP());
+                STORE_FRAME();
+
+                ObjClosure* cached = lookupInvokeCache(cache, (Obj*)superclass);
+                if (cached != NULL) {
+                    if (!call(cached, argCount)) { return INTERPRET_RUNTIME_ERROR; }
+                }
+                else if (!invokeFromClass(superclass, cache->name, argCount, cache, (Obj*)superclass)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                LOAD_FRAME();
+                DISPATCH();
             }
 
-            case OP_CLOSURE: { // added in ch25
-                ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
+            CASE(OP_CLOSURE): // added in ch25
+            CASE(OP_CLOSURE_LONG): {
+                // ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
+                ObjFunction* function = AS_FUNCTION(READ_CONSTANT_OPERAND(OP_CLOSURE_LONG));
+                STORE_FRAME();
                 ObjClosure* closure = newClosure(function);
                 push(OBJ_VAL(closure));
 
                 for (int i = 0; i < closure->upvalueCount; i++) {
-                    uint8_t isLocal = READ_BYTE();
-                    uint8_t index = READ_BYTE();
-                    if (isLocal) { closure->upvalues[i] = captureUpvalue(frame->slots + index); } 
+                    // uint8_t isLocal = READ_BYTE();
+                    // uint8_t index = READ_BYTE();
+                    uint8_t flags = READ_BYTE();
+                    int     index = flags & CAPTURE_WIDE ? READ_SHORT() : READ_BYTE();
+                    if (flags & CAPTURE_LOCAL) { closure->upvalues[i] = captureUpvalue(slots + index); } 
                     else { closure->upvalues[i] = frame->closure->upvalues[index]; }
+                    writeBarrier((Obj*)closure, (Obj*)closure->upvalues[i]); // capturing may have collected
                 }
 
-                break;
+                sp = vm.stackTop;
+                DISPATCH();
             }
 
-            case OP_CLOSE_UPVALUE: // added in ch25
-                closeUpvalues(vm.stackTop - 1);
-                pop();
-                break;
+            CASE(OP_CLOSE_UPVALUE): // added in ch25
+                closeUpvalues(sp - 1);
+                DROP(1);
+                DISPATCH();
 
-            case OP_RETURN: { // modified in ch24
-                Value result = pop();
-                closeUpvalues(frame->slots); // added in ch25
+            CASE(OP_RETURN): { // modified in ch24
+                Value result = POP();
+                closeUpvalues(slots); // added in ch25
                 vm.frameCount--;
                 if (vm.frameCount == 0) {
-                    pop();
+                    vm.stackTop = slots;
                     return INTERPRET_OK;
                 }
 
-                vm.stackTop = frame->slots;
-                push(result);
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+                sp = slots;
+                PUSH(result);
+                vm.stackTop = sp;
+                LOAD_FRAME();
+                DISPATCH();
 
                 // // printValue(pop());
                 // // std::cout << "\n";
                 // return INTERPRET_OK;
             }
 
-            case OP_CLASS: { // added in ch27
-                push(OBJ_VAL(newClass(READ_STRING())));
-                break;
+            CASE(OP_CLASS): // added in ch27
+            CASE(OP_CLASS_LONG): {
+                // ObjString* name = READ_STRING();
+                ObjString* name = AS_STRING(READ_CONSTANT_OPERAND(OP_CLASS_LONG));
+                STORE_FRAME();
+                PUSH(OBJ_VAL(newClass(name)));
+                DISPATCH();
             }
 
-            case OP_INHERIT: { // added in ch29
-                Value superclass = peek(1);
+            CASE(OP_INHERIT): { // added in ch29
+                Value superclass = PEEK(1);
 
-                if (!IS_CLASS(superclass)) {
-                    runtimeError("Superclass must be a class.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+                if (!IS_CLASS(superclass)) { RUNTIME_ERROR("Superclass must be a class."); }
 
-                ObjClass* subclass = AS_CLASS(peek(0));
+                ObjClass* subclass = AS_CLASS(PEEK(0));
+                STORE_FRAME();
                 tableAddAll(&AS_CLASS(superclass)->methods, &subclass->methods);
-                pop(); // Subclass.
-                break;
+                DROP(1); // Subclass.
+                DISPATCH();
+            }
+
+            CASE(OP_METHOD): // added in ch28
+            CASE(OP_METHOD_LONG): {
+                // ObjString* name = READ_STRING();
+                ObjString* name = AS_STRING(READ_CONSTANT_OPERAND(OP_METHOD_LONG));
+                STORE_FRAME();
+                defineMethod(name);
+                sp = vm.stackTop;
+                DISPATCH();
+            }
+
+            CASE(OP_REG_MOVE): {
+                uint8_t dst = READ_BYTE();
+                slots[dst] = slots[READ_BYTE()];
+                DISPATCH();
+            }
+
+            CASE(OP_REG_LOAD_CONSTANT): {
+                uint8_t dst = READ_BYTE();
+                slots[dst] = READ_CONSTANT();
+                DISPATCH();
+            }
+
+            CASE(OP_REG_ADD):               REGISTER_ADD(slots[READ_BYTE()]);     DISPATCH();
+            CASE(OP_REG_SUBTRACT):          REGISTER_OP(-, slots[READ_BYTE()]);   DISPATCH();
+            CASE(OP_REG_MULTIPLY):          REGISTER_OP(*, slots[READ_BYTE()]);   DISPATCH();
+            CASE(OP_REG_DIVIDE):            REGISTER_OP(/, slots[READ_BYTE()]);   DISPATCH();
+            CASE(OP_REG_ADD_CONSTANT):      REGISTER_ADD(READ_CONSTANT());        DISPATCH();
+            CASE(OP_REG_SUBTRACT_CONSTANT): REGISTER_OP(-, READ_CONSTANT());      DISPATCH();
+            CASE(OP_REG_MULTIPLY_CONSTANT): REGISTER_OP(*, READ_CONSTANT());      DISPATCH();
+            CASE(OP_REG_DIVIDE_CONSTANT):   REGISTER_OP(/, READ_CONSTANT());      DISPATCH();
+
+            CASE(OP_ADD_LOCALS): {
+                Value a = slots[READ_BYTE()];
+                Value b = slots[READ_BYTE()];
+                PUSH_SUM(a, b);
+                DISPATCH();
+            }
+
+            CASE(OP_ADD_LOCAL_CONSTANT): {
+                Value a = slots[READ_BYTE()];
+                Value b = READ_CONSTANT();
+                PUSH_SUM(a, b);
+                DISPATCH();
+            }
+
+            CASE(OP_SUBTRACT_LOCAL_CONSTANT): {
+                Value a = slots[READ_BYTE()];
+                Value b = READ_CONSTANT();
+                if (!IS_NUMBER(a) || !IS_NUMBER(b)) { RUNTIME_ERROR("Operands must be numbers."); }
+                PUSH(NUMBER_VAL(AS_NUMBER(a) - AS_NUMBER(b)));
+                DISPATCH();
             }
 
-            case OP_METHOD: { // added in ch28
-                defineMethod(READ_STRING());
-                break;
+            CASE(OP_SET_LOCAL_POP): {
+                uint8_t slot = READ_BYTE();
+                slots[slot] = POP();
+                DISPATCH();
             }
+
+            CASE(OP_POPN): DROP(READ_BYTE()); DISPATCH();
+
+            CASE(OP_GET_THIS_PROPERTY): {
+                if (!IS_INSTANCE(slots[0])) { RUNTIME_ERROR("Only instances have properties."); }
+
+                ObjInstance*   instance = AS_INSTANCE(slots[0]);
+                PropertyCache* cache    = &frame->caches[READ_SHORT()];
+                ObjString*     name     = cache->name;
+
+                if (cache->shape == instance->shape && cache->slot >= 0) {
+                    CACHE_STAT(cacheHits);
+                    PUSH(instance->fields[cache->slot]);
+                    DISPATCH();
+                }
+
+                PUSH(slots[0]);
+                STORE_FRAME();
+                if (cache->shape == instance->shape) {
+                    CACHE_STAT(cacheHits);
+                    PEEK(0) = OBJ_VAL(newBoundMethod(PEEK(0), AS_CLOSURE(cache->method)));
+                    DISPATCH();
+                }
+
+                if (!getPropertyUncached(instance, name, cache)) { return INTERPRET_RUNTIME_ERROR; }
+                DISPATCH();
+            }
+
+            CASE(OP_POP_JUMP_IF_FALSE): {
+                uint16_t offset = READ_SHORT();
+                if (isFalsey(POP())) ip += offset;
+                DISPATCH();
+            }
+
+            CASE(OP_POP_JUMP_IF_TRUE): {
+                uint16_t offset = READ_SHORT();
+                if (!isFalsey(POP())) ip += offset;
+                DISPATCH();
+            }
+
+            CASE(OP_JUMP_IF_FALSE_OR_POP): {
+                uint16_t offset = READ_SHORT();
+                if (isFalsey(PEEK(0))) ip += offset;
+                else DROP(1);
+                DISPATCH();
+            }
+
+            CASE(OP_JUMP_IF_TRUE_OR_POP): {
+                uint16_t offset = READ_SHORT();
+                if (!isFalsey(PEEK(0))) ip += offset;
+                else DROP(1);
+                DISPATCH();
+            }
+
+            CASE(OP_JUMP_IF_NOT_LESS):    COMPARE_JUMP(<, false, READ_SHORT()); DISPATCH();
+            CASE(OP_JUMP_IF_LESS):        COMPARE_JUMP(<, true, READ_SHORT());  DISPATCH();
+            CASE(OP_JUMP_IF_NOT_GREATER): COMPARE_JUMP(>, false, READ_SHORT()); DISPATCH();
+            CASE(OP_JUMP_IF_GREATER):     COMPARE_JUMP(>, true, READ_SHORT());  DISPATCH();
+            CASE(OP_JUMP_IF_NOT_EQUAL):   EQUAL_JUMP(false, READ_SHORT());      DISPATCH();
+            CASE(OP_JUMP_IF_EQUAL):       EQUAL_JUMP(true, READ_SHORT());       DISPATCH();
+
+            CASE(OP_CONSTANT_LONG):
+                PUSH(constants[READ_LONG()]);
+                DISPATCH();
+
+            CASE(OP_GET_LOCAL_LONG): {
+                uint16_t slot = READ_SHORT();
+                PUSH(slots[slot]);
+                DISPATCH();
+            }
+
+            CASE(OP_SET_LOCAL_LONG): {
+                uint16_t slot = READ_SHORT();
+                slots[slot] = PEEK(0);
+                DISPATCH();
+            }
+
+            CASE(OP_GET_UPVALUE_LONG): {
+                uint16_t index = READ_SHORT();
+                PUSH(*frame->closure->upvalues[index]->location);
+                DISPATCH();
+            }
+
+            CASE(OP_SET_UPVALUE_LONG): {
+                uint16_t index = READ_SHORT();
+                *frame->closure->upvalues[index]->location = PEEK(0);
+                writeBarrierValue((Obj*)frame->closure->upvalues[index], PEEK(0));
+                DISPATCH();
+            }
+
+            // a jump whose distance outgrew 16 bits names the kind of jump it stands for and carries a 24-bit
+            // distance; it only turns up in very large functions, so one handler covers every kind
+            CASE(OP_LONG_JUMP): {
+                uint8_t  kind   = READ_BYTE();
+                uint32_t offset = READ_LONG();
+                switch (kind) {
+                    case OP_JUMP:                ip += offset;                        break;
+                    case OP_LOOP:                ip -= offset;                        break;
+                    case OP_JUMP_IF_FALSE:       if (isFalsey(PEEK(0))) ip += offset; break;
+                    case OP_POP_JUMP_IF_FALSE:   if (isFalsey(POP())) ip += offset;   break;
+                    case OP_POP_JUMP_IF_TRUE:    if (!isFalsey(POP())) ip += offset;  break;
+                    case OP_JUMP_IF_FALSE_OR_POP:
+                        if (isFalsey(PEEK(0))) ip += offset;
+                        else DROP(1);
+                        break;
+                    case OP_JUMP_IF_TRUE_OR_POP:
+                        if (!isFalsey(PEEK(0))) ip += offset;
+                        else DROP(1);
+                        break;
+                    case OP_JUMP_IF_NOT_LESS:    COMPARE_JUMP(<, false, offset);      break;
+                    case OP_JUMP_IF_LESS:        COMPARE_JUMP(<, true, offset);       break;
+                    case OP_JUMP_IF_NOT_GREATER: COMPARE_JUMP(>, false, offset);      break;
+                    case OP_JUMP_IF_GREATER:     COMPARE_JUMP(>, true, offset);       break;
+                    case OP_JUMP_IF_NOT_EQUAL:   EQUAL_JUMP(false, offset);           break;
+                    case OP_JUMP_IF_EQUAL:       EQUAL_JUMP(true, offset);            break;
+                    default: break; // Unreachable.
+                }
+                DISPATCH();
+            }
+    #ifndef COMPUTED_GOTO
         }
     }
-
+    #endif
+
+    #undef STORE_FRAME
+    #undef LOAD_FRAME
+    #undef PUSH
+    #undef POP
+    #undef PEEK
+    #undef DROP
+    #undef RUNTIME_ERROR
     #undef READ_BYTE
     #undef READ_SHORT // added in ch23
     #undef READ_CONSTANT
     #undef READ_STRING // added in ch21
+    #undef READ_LONG
+    #undef READ_CONSTANT_OPERAND
     #undef BINARY_OP
+    #undef REGISTER_OP
+    #undef REGISTER_ADD
+    #undef PUSH_SUM
+    #undef COMPARE_JUMP
+    #undef QUICKEN
+    #undef NUMBER_OP
+    #undef EQUAL_JUMP
+    #undef TRACE_EXECUTION
+    #undef CASE
+    #undef DISPATCH
 }
 
 // InterpretResult interpret (Chunk* chunk) { // modified in ch16
@@ -647,11 +1368,17 @@ InterpretResult interpret (const char* source) { // added in ch17
     ObjFunction* function = compile(source); // added in ch24
     if (function == NULL) return INTERPRET_COMPILE_ERROR; // added in ch24 
 
+    return interpretFunction(function);
+}
+
+// runs a compiled top-level script, whether fresh from the compiler or loaded from a .loxc file
+InterpretResult interpretFunction (ObjFunction* function) {
     push(OBJ_VAL(function));                        // added in ch24 
     ObjClosure* closure = newClosure(function);     // added in ch25
     pop();                                          // added in ch24
     push(OBJ_VAL(closure));                         // added in ch25
-    call(closure, 0);                               // added in ch25
+    // call(closure, 0);                             // added in ch25
+    if (!call(closure, 0)) return INTERPRET_RUNTIME_ERROR;
  
     // call(function, 0);                              // added in ch24
 
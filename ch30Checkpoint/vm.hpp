@@ -2,43 +2,94 @@
 #define clox_vm_hpp
 
 // #include "chunk.hpp"
+#include "heap.hpp"
 #include "object.hpp" // added in ch24
 #include "table.hpp"  // added in ch20
 #include "value.hpp"
  
 // #define STACK_MAX 256
-#define FRAMES_MAX 64 // added in ch24
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT) // added in ch24
+// #define FRAMES_MAX 64 // added in ch24
+// #define STACK_MAX (FRAMES_MAX * UINT8_COUNT) // added in ch24
+
+// default limits; the stack and frame arrays start small and grow on demand up to these
+#define FRAMES_MAX  65536
+#define STACK_MAX   (FRAMES_MAX * UINT8_COUNT)
+#define FRAMES_INIT 64
+#define STACK_INIT  256
+#define GC_MAX_PAUSE    1000 // microseconds a step of a full collection may run for
+#define GC_MARK_THREADS 1    // threads tracing the heap, the main thread included; 1 traces on the main thread alone
+#define GC_MARKERS_MAX  64
 
 // represents a call frame
 typedef struct { // added in ch24
     // ObjFunction* function;
-    ObjClosure*  closure; // added in ch25
-    uint8_t*     ip;
-    Value*       slots;
+    ObjClosure*    closure;   // added in ch25
+    uint8_t*       ip;
+    Value*         slots;
+    uint8_t*       code;      // closure->function->chunk.code, cached so frame switches skip the pointer walk
+    Value*         constants; // closure->function->chunk.constants.values
+    PropertyCache* caches;    // closure->function->chunk.caches
+    InvokeCache*   invokeCaches;
 } CallFrame;
 
+// what the collector is doing between allocations
+typedef enum {
+    GC_IDLE,  // nothing; collections are minor until a full one is needed
+    GC_MARK,  // a full collection is tracing from the gray stack, a step at a time
+    GC_SWEEP, // a full collection is sweeping the pages it marked, a step at a time
+} GCPhase;
+
+// a growable list of pointers the collector keeps from one collection to the next
+typedef struct {
+    void** items;
+    int    count;
+    int    capacity;
+} GCList;
+
 // represents a virtual machine
 typedef struct {
-    CallFrame   frames[FRAMES_MAX]; // added in ch24
-    int         frameCount;         // added in ch24
+    // CallFrame frames[FRAMES_MAX]; // added in ch24
+    CallFrame*  frames;
+    int         frameCount;     // added in ch24
+    int         frameCapacity;
+    int         framesMax;      // deepest call chain before "Stack overflow."
 
     // Chunk*   chunk;
     // uint8_t* ip;
     // Value stack[STACK_MAX];
 
-    Value       stack[256];
+    // Value    stack[256];
+    Value*      stack;          // moves when it grows, so frame slots and open upvalues are relocated with it
     Value*      stackTop;
-    Table       globals;        // added in ch21
+    int         stackCapacity;
+    int         stackMax;       // most slots the stack may grow to
+    // Table    globals;        // added in ch21
+    Table       globalSlots;    // global name -> index into globalValues, assigned by the compiler
+    ValueArray  globalNames;    // index -> name, for error messages
+    ValueArray  globalValues;   // UNDEFINED_VAL until the global's definition runs
     Table       strings;        // added in ch20
+    LiteralBlock* literals;     // arena behind the characters of strings copied from program text
     ObjString*  initString;     // added in ch28
     ObjUpvalue* openUpvalues;   // added in ch25
     size_t      bytesAllocated; // added in ch26
     size_t      nextGC;         // added in ch26
-    Obj*        objects;        // added in ch19
+    size_t      nextFullGC;     // heap size past which a full collection starts, then the size it means to be done by
+    GCPhase     gcPhase;
+    uint64_t    gcMaxPause;     // nanoseconds a step of a full collection may run for
+    int         markThreads;    // threads that trace together, up to GC_MARKERS_MAX
+    // Obj*     objects;        // added in ch19
+    Heap        heap;
     int         grayCount;      // added in ch26
     int         grayCapacity;   // added in ch26
     Obj**       grayStack;      // added in ch26
+    GCList      rememberedObjects; // old objects given a reference to a young one since the last collection
+    GCList      rememberedTables;  // tables and arrays the same, whose owners the barrier can't see
+    GCList      rememberedArrays;
+    GCList      youngStrings;      // strings interned since the last collection
+
+    size_t      cacheHits;        // inline cache counters, only kept with DEBUG_LOG_CACHE
+    size_t      cacheMisses;
+    size_t      cacheMegamorphic;
 } VM;
 
 // enumerates the possible results of interpreting a chunk
@@ -50,12 +101,15 @@ typedef enum {
 
 extern VM vm; // added in ch19
 
-void initVM ();
+// void initVM ();
+void initVM (int framesMax = FRAMES_MAX, int stackMax = STACK_MAX, int gcMaxPause = GC_MAX_PAUSE, int markThreads = GC_MARK_THREADS);
 void freeVM ();
 static InterpretResult run ();
 // InterpretResult interpret (Chunk* chunk); // modified in ch16
-InterpretResult interpret (const char* source); // added in ch16
+InterpretResult interpret         (const char* source); // added in ch16
+InterpretResult interpretFunction (ObjFunction* function);
 void push (Value value);
 Value pop ();
+int globalSlot (ObjString* name);
 
 #endif
\ No newline at end of file